@@ -0,0 +1,36 @@
+#include <cstdio>
+#include <string>
+
+#include "../../src/sjson.hpp"
+
+using namespace sjson::literals;
+
+int main()
+{
+    const char *test = "{\"name\" : \"list\", \"items\" : [{\"name\" : \"a\", \"n\" : 1},"
+                       " {\"name\" : \"b\", \"n\" : 2}], \"weights\" : [0.5, 1.5]}";
+
+    sjson::document doc = sjson::document::parse(test);
+    if (!doc) {
+        return 1;
+    }
+    for (sjson::field f : doc.root()) {
+        std::printf("%.*s ", (int) f.name.size(), f.name.data());
+    }
+    std::printf("\n");
+
+    sjson::key_index idx(doc.root());
+    double total = 0;
+    for (sjson::value item : idx["items"_key].as_array()) {
+        std::string_view name = item["name"_key].as_string();
+        std::printf("%.*s = %g\n", (int) name.size(), name.data(), item["n"_key].as_number());
+    }
+    for (sjson::value w : idx["weights"_key].as_array()) {
+        total += w.as_number();
+    }
+    std::printf("%g %zu\n", total, idx.size());
+
+    sjson::document copy = doc.clone();
+    std::printf("%s\n", copy.write().c_str());
+    return 0;
+}
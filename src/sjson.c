@@ -1,6 +1,31 @@
 #include "sjson.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define S_HAVE_MMAP 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define S_HAVE_PTHREAD 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define S_HAVE_SSSE3_DISPATCH 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define S_HAVE_SSE2 1
+#endif
 
 #define S_ISDIGIT(c) ((c) >= 0x30 && (c) <= 0x39)
 
@@ -15,19 +40,186 @@
         return (r);                           \
     } 
 
+#define S_CHECK_VALUE_FOUND(r)                    \
+    if (value == NULL) {                          \
+        if (err) {                                \
+            *err = S_ERROR_CODE_OBJECT_NOT_FOUND; \
+        }                                         \
+        return (r);                               \
+    }                                             \
+    if (err) {                                    \
+        *err = S_ERROR_CODE_OK;                   \
+    }
+
+#if defined(__GNUC__)
+#define S_ATOMIC_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define S_ATOMIC_INC(p)       __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define S_ATOMIC_DEC(p)       __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define S_ATOMIC_CAS(p, e, d) __atomic_compare_exchange_n((p), (e), (d), 0, \
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define S_ATOMIC_OR(p, v)     __atomic_or_fetch((p), (v), __ATOMIC_RELEASE)
+#define S_ATOMIC_GET(p, r)    __atomic_load((p), (r), __ATOMIC_RELAXED)
+#define S_ATOMIC_SET(p, v)    __atomic_store((p), (v), __ATOMIC_RELAXED)
+#else
+/* No atomics: documents must not be shared between threads */
+#define S_ATOMIC_LOAD(p)      (*(p))
+#define S_ATOMIC_INC(p)       (++*(p))
+#define S_ATOMIC_DEC(p)       (--*(p))
+#define S_ATOMIC_CAS(p, e, d) (*(p) == *(e) ? (*(p) = (d), 1) : (*(e) = *(p), 0))
+#define S_ATOMIC_OR(p, v)     (*(p) |= (v))
+#define S_ATOMIC_GET(p, r)    (*(r) = *(p))
+#define S_ATOMIC_SET(p, v)    (*(p) = *(v))
+#endif
+
 #define S_STRINGIZE_NX(x) #x
 #define S_STRINGIZE(x) S_STRINGIZE_NX(x)
 #define S_WRITE_NUMBER_FORMAT "%." S_STRINGIZE(S_WRITE_NUMBER_NUM_DECIMAL_POINT) "f"
 
+typedef struct s_S_projection S_projection_t;
+
 typedef struct {
-    char *ptr;
-    char *end;
+    char           *ptr;
+    char           *end;
+    unsigned int   flags;
+    S_parser_t     *parser;     // NULL when values are heap allocated
+    S_value_t      *stack;      // Scratch stack for array elements and object fields
+    size_t         stack_len;
+    size_t         stack_size;
+    double         *nums;       // Scratch stack for packed array elements
+    size_t         nums_len;
+    size_t         nums_size;
+    S_projection_t *projection; // Fields kept in the current object, NULL for all
 } S_ctx;
 
+/*
+ * Streaming XXH64, so serialized bytes can be hashed as they
+ * are produced instead of being stored.
+ */
+#define S_HASH_PRIME_1 11400714785074694791ULL
+#define S_HASH_PRIME_2 14029467366897019727ULL
+#define S_HASH_PRIME_3 1609587929392839161ULL
+#define S_HASH_PRIME_4 9650029242287828579ULL
+#define S_HASH_PRIME_5 2870177450012600261ULL
+
+#define S_HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
 typedef struct {
-    char   *data;
-    size_t len;
-    size_t size;
+    uint64_t      total_len;
+    uint64_t      acc[4];
+    unsigned char mem[32];
+    size_t        mem_len;
+} S_hash_t;
+
+static uint64_t S_hash_read64(const unsigned char *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16
+        | (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40
+        | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint64_t S_hash_round(uint64_t acc, uint64_t input) {
+    acc += input * S_HASH_PRIME_2;
+    acc = S_HASH_ROTL(acc, 31);
+    return acc * S_HASH_PRIME_1;
+}
+
+static uint64_t S_hash_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= S_hash_round(0, val);
+    return acc * S_HASH_PRIME_1 + S_HASH_PRIME_4;
+}
+
+static void S_hash_init(S_hash_t *hash) {
+    hash->total_len = 0;
+    hash->acc[0] = S_HASH_PRIME_1 + S_HASH_PRIME_2;
+    hash->acc[1] = S_HASH_PRIME_2;
+    hash->acc[2] = 0;
+    hash->acc[3] = 0 - S_HASH_PRIME_1;
+    hash->mem_len = 0;
+}
+
+static void S_hash_stripe(S_hash_t *hash, const unsigned char *p) {
+    hash->acc[0] = S_hash_round(hash->acc[0], S_hash_read64(p));
+    hash->acc[1] = S_hash_round(hash->acc[1], S_hash_read64(p + 8));
+    hash->acc[2] = S_hash_round(hash->acc[2], S_hash_read64(p + 16));
+    hash->acc[3] = S_hash_round(hash->acc[3], S_hash_read64(p + 24));
+}
+
+static void S_hash_update(S_hash_t *hash, const char *data, size_t len) {
+    const unsigned char *p;
+    size_t              n;
+
+    p = (const unsigned char *) data;
+    hash->total_len += len;
+    if (hash->mem_len + len < 32) {
+        memcpy(&hash->mem[hash->mem_len], p, len);
+        hash->mem_len += len;
+        return;
+    }
+    if (hash->mem_len > 0) {
+        n = 32 - hash->mem_len;
+        memcpy(&hash->mem[hash->mem_len], p, n);
+        S_hash_stripe(hash, hash->mem);
+        p += n;
+        len -= n;
+        hash->mem_len = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) {
+        S_hash_stripe(hash, p);
+    }
+    memcpy(hash->mem, p, len);
+    hash->mem_len = len;
+}
+
+static uint64_t S_hash_digest(S_hash_t *hash) {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t            h;
+
+    if (hash->total_len >= 32) {
+        h = S_HASH_ROTL(hash->acc[0], 1) + S_HASH_ROTL(hash->acc[1], 7)
+            + S_HASH_ROTL(hash->acc[2], 12) + S_HASH_ROTL(hash->acc[3], 18);
+        h = S_hash_merge_round(h, hash->acc[0]);
+        h = S_hash_merge_round(h, hash->acc[1]);
+        h = S_hash_merge_round(h, hash->acc[2]);
+        h = S_hash_merge_round(h, hash->acc[3]);
+    } else {
+        h = hash->acc[2] + S_HASH_PRIME_5;
+    }
+    h += hash->total_len;
+    p = hash->mem;
+    end = p + hash->mem_len;
+    for (; p + 8 <= end; p += 8) {
+        h ^= S_hash_round(0, S_hash_read64(p));
+        h = S_HASH_ROTL(h, 27) * S_HASH_PRIME_1 + S_HASH_PRIME_4;
+    }
+    if (p + 4 <= end) {
+        h ^= ((uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16
+            | (uint64_t) p[3] << 24) * S_HASH_PRIME_1;
+        h = S_HASH_ROTL(h, 23) * S_HASH_PRIME_2 + S_HASH_PRIME_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * S_HASH_PRIME_5;
+        h = S_HASH_ROTL(h, 11) * S_HASH_PRIME_1;
+    }
+    h ^= h >> 33;
+    h *= S_HASH_PRIME_2;
+    h ^= h >> 29;
+    h *= S_HASH_PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+typedef struct {
+    char                      *data;
+    size_t                    len;
+    size_t                    size;
+    int                       canonical;  // Sorted keys, shortest numbers, no caches
+    S_hash_t                  *hash;      // When set, bytes are hashed instead of stored
+    void                      *split;     // Body of the container written empty, see S_write_parallel
+    size_t                    split_at;   // Offset of its elements once written, 0 before
+    struct s_S_fragment_block *blocks;    // Scratch stack of cache blocks, see S_write_container
+    size_t                    num_blocks;
+    size_t                    blocks_size;
 } S_write_ctx_t;
 
 static void S_skip_whitespace(S_ctx *ctx) {
@@ -47,16 +239,218 @@ static int S_skip_over_if_possible(S_ctx *ctx) {
     return 1;
 }
 
+/*
+ * Skips a string without looking at its content, other than
+ * finding the closing quote.
+ */
+static int S_skip_string(S_ctx *ctx) {
+    char *p;
+    char *q;
+
+    p = ctx->ptr + 1;
+    for (;;) {
+        p = memchr(p, '"', ctx->end - p);
+        if (p == NULL) {
+            return 0;
+        }
+        for (q = p; q > ctx->ptr + 1 && q[-1] == '\\'; q--);
+        if ((p - q) % 2 == 0) {
+            break; // Not escaped
+        }
+        p++;
+    }
+    ctx->ptr = p + 1;
+    return 1;
+}
+
+/*
+ * Skips a value by matching brackets and quotes only. The
+ * value is not validated.
+ */
+static int S_skip_value(S_ctx *ctx) {
+    size_t depth;
+
+    if (ctx->ptr == ctx->end) {
+        return 0;
+    }
+    if (*ctx->ptr == '"') {
+        return S_skip_string(ctx);
+    }
+    if (*ctx->ptr != '[' && *ctx->ptr != '{') {
+        while (ctx->ptr != ctx->end && *ctx->ptr != ',' && *ctx->ptr != ']'
+                && *ctx->ptr != '}' && *ctx->ptr != ' ' && *ctx->ptr != '\n'
+                && *ctx->ptr != '\r' && *ctx->ptr != '\t') {
+            ctx->ptr++;
+        }
+        return 1;
+    }
+    depth = 0;
+    while (ctx->ptr != ctx->end) {
+        switch (*ctx->ptr) {
+            case '"':
+                if (S_skip_string(ctx) == 0) {
+                    return 0;
+                }
+                continue;
+            case '[':
+            case '{':
+                depth++;
+                break;
+            case ']':
+            case '}':
+                if (--depth == 0) {
+                    ctx->ptr++;
+                    return 1;
+                }
+                break;
+            default:
+                break;
+        }
+        ctx->ptr++;
+    }
+    return 0;
+}
+
+/*
+ * Scans the shared lexical grammar. On success the pointer is
+ * left after the token (on the closing quote for strings);
+ * on failure it is left near the offending byte.
+ */
+
+/*
+ * Finds the closing quote of a string, stepping over escapes,
+ * sixteen bytes at a time where SSE2 is available.
+ */
+static int S_scan_string(S_ctx *ctx) {
+    char     *p;
+#ifdef S_HAVE_SSE2
+    __m128i  block;
+    unsigned mask;
+#endif
+
+    p = ctx->ptr + 1;
+    for (;;) {
+#ifdef S_HAVE_SSE2
+        while (ctx->end - p >= 16) {
+            block = _mm_loadu_si128((const __m128i *) p);
+            mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+                                                  _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))));
+            if (mask != 0) {
+                p += __builtin_ctz(mask);
+                break;
+            }
+            p += 16;
+        }
+#endif
+        while (p != ctx->end && *p != '"' && *p != '\\') {
+            p++;
+        }
+        if (p == ctx->end) {
+            ctx->ptr = p;
+            return 0;
+        }
+        if (*p == '"') {
+            break;
+        }
+        if (++p == ctx->end) {
+            ctx->ptr = p;
+            return 0;
+        }
+        p++; // Escaped char is kept as is
+    }
+    ctx->ptr = p;
+    return 1;
+}
+
+/*
+ * Number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+static int S_scan_number(S_ctx *ctx) {
+    char *p;
+
+    p = ctx->ptr;
+    if (p != ctx->end && *p == '-') {
+        p++;
+    }
+    if (p == ctx->end || !S_ISDIGIT(*p)) {
+        ctx->ptr = p;
+        return 0;
+    }
+    if (*p++ != '0') {
+        while (p != ctx->end && S_ISDIGIT(*p)) {
+            p++;
+        }
+    }
+    if (p != ctx->end && *p == '.') {
+        if (++p == ctx->end || !S_ISDIGIT(*p)) {
+            ctx->ptr = p;
+            return 0;
+        }
+        while (p != ctx->end && S_ISDIGIT(*p)) {
+            p++;
+        }
+    }
+    if (p != ctx->end && (*p == 'e' || *p == 'E')) {
+        if (++p != ctx->end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p == ctx->end || !S_ISDIGIT(*p)) {
+            ctx->ptr = p;
+            return 0;
+        }
+        while (p != ctx->end && S_ISDIGIT(*p)) {
+            p++;
+        }
+    }
+    ctx->ptr = p;
+    return 1;
+}
+
+static int S_scan_literal(S_ctx *ctx, const char *literal, size_t len) {
+    if ((size_t) (ctx->end - ctx->ptr) < len || memcmp(ctx->ptr, literal, len) != 0) {
+        return 0;
+    }
+    ctx->ptr += len;
+    return 1;
+}
+
+static void S_ctx_init(S_ctx *ctx, const char *data, size_t sz, unsigned int flags) {
+    ctx->ptr = (char *) data;
+    ctx->end = (char *) data + sz;
+    ctx->flags = flags;
+    ctx->parser = NULL;
+    ctx->stack = NULL;
+    ctx->stack_len = 0;
+    ctx->stack_size = 0;
+    ctx->nums = NULL;
+    ctx->nums_len = 0;
+    ctx->nums_size = 0;
+    ctx->projection = NULL;
+}
+
 static S_write_ctx_t S_write_ctx_create(void) {
     S_write_ctx_t ctx;
 
     ctx.len = 0;
     ctx.size = 256;
     ctx.data = malloc(ctx.size);
+    ctx.canonical = 0;
+    ctx.hash = NULL;
+    ctx.split = NULL;
+    ctx.split_at = 0;
+    ctx.blocks = NULL;
+    ctx.num_blocks = 0;
+    ctx.blocks_size = 0;
     return ctx;
 }
 
+/*
+ * Frees the buffer, unless it was taken (set to NULL) as the
+ * result, and the scratch stack.
+ */
 static void S_write_ctx_destroy(S_write_ctx_t *ctx) {
+    free(ctx->blocks);
+    ctx->blocks = NULL;
     if (ctx->data == NULL) {
         return;
     }
@@ -78,787 +472,4191 @@ static int S_write_ctx_reallocate_if_needed(S_write_ctx_t *ctx, size_t extra) {
     return 1;
 }
 
-static int S_write_add_string(S_write_ctx_t *ctx, const char *str) {
-    size_t len;
-
-    len = strlen(str);
+static int S_write_add_bytes(S_write_ctx_t *ctx, const char *data, size_t len) {
+    if (ctx->hash != NULL) {
+        S_hash_update(ctx->hash, data, len);
+        return 1;
+    }
     if (S_write_ctx_reallocate_if_needed(ctx, len) == 0) {
         return 0;
     }
-    memcpy(&ctx->data[ctx->len], str, len);
+    memcpy(&ctx->data[ctx->len], data, len);
     ctx->len += len;
     return 1;
 }
 
-/* -------------------- Value -------------------- */
-
-typedef enum e_S_value_type {
-    S_VALUE_TYPE_STRING = 0,
-    S_VALUE_TYPE_NUMBER,
-    S_VALUE_TYPE_OBJECT,
-    S_VALUE_TYPE_ARRAY,
-    S_VALUE_TYPE_BOOLEAN,
-    S_VALUE_TYPE_NULL
-} S_value_type_t;
-
-typedef struct s_S_value {
-    S_value_type_t type;
-} S_value_t;
+static int S_write_add_string(S_write_ctx_t *ctx, const char *str) {
+    return S_write_add_bytes(ctx, str, strlen(str));
+}
 
-static S_value_t  *S_parse_value(S_ctx *ctx);
-static void       S_value_destroy(S_value_t **value);
-static int        S_write_value(S_write_ctx_t *ctx, S_value_t *val);
+/* -------------------- Parser -------------------- */
 
-/* ----------------------------------------------- */
+#define S_ARENA_ALIGN      16
+#define S_ARENA_BLOCK_SIZE (64 * 1024)
+#define S_STACK_SIZE       64
+#define S_NUMBER_BUF_SIZE  64
 
-/* -------------------- String -------------------- */
+typedef struct s_S_arena_block {
+    struct s_S_arena_block *next;
+    size_t                 size;
+    size_t                 used;
+    char                   *data;
+} S_arena_block_t;
 
-typedef struct {
-    S_value_t this_value;
-    char      *data;
-    size_t    len;
-} S_string_t;
+typedef struct s_S_parser {
+    S_arena_block_t *head;
+    S_arena_block_t *curr;
+    S_value_t       *stack;
+    size_t          stack_size;
+    double          *nums;
+    size_t          nums_size;
+    unsigned int    flags;
+    S_arena_block_t *extra; // Allocated by readers of the document
+} S_parser_t;
 
-static S_string_t *S_string_create(void) {
-    S_string_t *str;
+static S_arena_block_t *S_arena_block_create(size_t size) {
+    S_arena_block_t *block;
 
-    str = malloc(sizeof *str);
-    if (str == NULL) {
+    block = malloc(sizeof *block + size);
+    if (block == NULL) {
         return NULL;
     }
-    str->len = 0;
-    str->data = NULL;
-    str->this_value.type = S_VALUE_TYPE_STRING;
-    return str;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->data = (char *) (block + 1);
+    return block;
 }
 
-static void S_string_destroy(S_string_t **str) {
-    free((*str)->data);
-    free(*str);
-    *str = NULL;
-}
+/*
+ * Bump allocates from the current block, moving on to the
+ * next retained block (or a new one) when it is full.
+ */
+static void *S_arena_alloc(S_parser_t *parser, size_t size) {
+    S_arena_block_t *block;
+    void            *ptr;
 
-static S_string_t *S_parse_string(S_ctx *ctx) {
-    S_string_t *str;
-    char       *start;
-   
-    if (*ctx->ptr != '"') {
-        return NULL;
-    }
-    str = S_string_create();
-    if (str == NULL) {
-        return NULL;
-    }
-    start = ctx->ptr + 1;
-    while (++ctx->ptr != ctx->end && *ctx->ptr != '"') {
-        if (*ctx->ptr != '\\' || *(++ctx->ptr) != 'u') {
-            str->len++;
-            continue;
+    size = (size + S_ARENA_ALIGN - 1) & ~(size_t) (S_ARENA_ALIGN - 1);
+    while (parser->curr->used + size > parser->curr->size) {
+        block = parser->curr->next;
+        if (block == NULL || block->size < size) {
+            block = S_arena_block_create(size > 2 * parser->curr->size ? size : 2 * parser->curr->size);
+            if (block == NULL) {
+                return NULL;
+            }
+            block->next = parser->curr->next;
+            parser->curr->next = block;
         }
-        str->len += 4; // 4 unicode chars
+        block->used = 0;
+        parser->curr = block;
     }
-    str->data = calloc(1, str->len + 1);
-    memcpy(str->data, start, str->len);
-    ctx->ptr++;
-    return str;
+    ptr = &parser->curr->data[parser->curr->used];
+    parser->curr->used += size;
+    return ptr;
 }
 
-static int S_write_string(S_write_ctx_t *ctx, S_string_t *str) {
-    char *temp;
+static void S_arena_blocks_destroy(S_arena_block_t *block) {
+    S_arena_block_t *next;
 
-    if (S_write_add_string(ctx, "\"") == 0) {
-        return 0;
+    for (; block != NULL; block = next) {
+        next = block->next;
+        free(block);
     }
-    temp = calloc(1, str->len + 1);
-    if (temp == NULL) {
-        return 0;
+}
+
+/*
+ * Keeps a block allocated while the document is read, to be
+ * freed with the arena. Readers may run in several threads.
+ */
+static void S_arena_keep(S_parser_t *parser, S_arena_block_t *block) {
+    block->next = S_ATOMIC_LOAD(&parser->extra);
+    while (!S_ATOMIC_CAS(&parser->extra, &block->next, block)) {
+        continue;
     }
-    memcpy(temp, str->data, str->len);
-    if (S_write_add_string(ctx, temp) == 0) {
-        return 0;
+}
+
+static void S_arena_reset(S_parser_t *parser) {
+    S_arena_blocks_destroy(parser->extra);
+    parser->extra = NULL;
+    parser->curr = parser->head;
+    parser->head->used = 0;
+}
+
+static void *S_ctx_alloc(S_ctx *ctx, size_t size) {
+    if (ctx != NULL && ctx->parser != NULL) {
+        return S_arena_alloc(ctx->parser, size);
     }
-    if (S_write_add_string(ctx, "\"") == 0) {
-        return 0;
+    return malloc(size);
+}
+
+static int S_ctx_push_number(S_ctx *ctx, double value) {
+    double *temp;
+    size_t size;
+
+    if (ctx->nums_len == ctx->nums_size) {
+        size = ctx->nums_size == 0 ? S_STACK_SIZE : 2 * ctx->nums_size;
+        temp = realloc(ctx->nums, sizeof *ctx->nums * size);
+        if (temp == NULL) {
+            return 0;
+        }
+        ctx->nums = temp;
+        ctx->nums_size = size;
     }
+    ctx->nums[ctx->nums_len++] = value;
     return 1;
 }
 
 /* ------------------------------------------------ */
 
-/* -------------------- Array -------------------- */
+/* -------------------- Projection -------------------- */
 
-typedef struct s_S_array {
-    S_value_t this_value;
-    S_value_t **values;
-    size_t    num_values;
-    size_t    size;
-} S_array_t;
+/*
+ * Tree of the key paths kept by S_parse_projected, one level
+ * per path component. A field without children is kept whole.
+ */
+typedef struct s_S_projection {
+    const char            *name;
+    size_t                len;
+    struct s_S_projection *child;
+    struct s_S_projection *next;
+} S_projection_t;
 
-static S_array_t *S_array_create(void) {
-    S_array_t *arr;
+static void S_projection_destroy(S_projection_t **projection) {
+    S_projection_t *curr;
+    S_projection_t *next;
 
-    arr = malloc(sizeof *arr);
-    if (arr == NULL) {
-        return NULL;
+    for (curr = *projection; curr != NULL; curr = next) {
+        next = curr->next;
+        S_projection_destroy(&curr->child);
+        free(curr);
     }
-    arr->this_value.type = S_VALUE_TYPE_ARRAY;
-    arr->num_values = 0;
-    arr->size = 0;
-    arr->values = NULL;
-    return arr;
+    *projection = NULL;
 }
 
-static void S_array_destroy(S_array_t **arr) {
-    size_t i;
-
-    if ((*arr)->values == NULL) {
-        free(*arr);
-        *arr = NULL;
-        return;
-    }
-    for (i = 0; i < (*arr)->num_values; i++) {
-        S_value_destroy(&(*arr)->values[i]);
+static S_projection_t *S_projection_find(S_projection_t *projection, const char *name, size_t len) {
+    for (; projection != NULL; projection = projection->next) {
+        if (projection->len == len && memcmp(projection->name, name, len) == 0) {
+            return projection;
+        }
     }
-    free(*arr);
-    *arr = NULL;
+    return NULL;
 }
 
-static int S_array_emplace_value(S_array_t *arr, S_value_t *value) {
-    S_value_t **temp;
+/*
+ * Adds a dot separated path to the tree. Paths stay pointing
+ * into the caller's strings.
+ */
+static int S_projection_add(S_projection_t **projection, const char *path) {
+    S_projection_t *field;
+    const char     *dot;
+    size_t         len;
+    int            created;
 
-    if (arr->values == NULL) {
-        arr->size = 8;
-        arr->values = malloc(sizeof *arr->values * arr->size);
-        if (arr->values == NULL) {
-            return 0;
+    for (;;) {
+        dot = strchr(path, '.');
+        len = dot == NULL ? strlen(path) : (size_t) (dot - path);
+        field = S_projection_find(*projection, path, len);
+        created = field == NULL;
+        if (created) {
+            field = malloc(sizeof *field);
+            if (field == NULL) {
+                return 0;
+            }
+            field->name = path;
+            field->len = len;
+            field->child = NULL;
+            field->next = *projection;
+            *projection = field;
+        } else if (field->child == NULL) {
+            return 1; // Already kept whole
         }
-    }
-    if (arr->num_values - 1 >= arr->size) {
-        arr->size = arr->size * 2;
-        temp = realloc(arr->values, sizeof *arr->values * arr->size);
-        if (temp == NULL) {
-            return 0;
+        if (dot == NULL) {
+            S_projection_destroy(&field->child);
+            return 1;
         }
-        arr->values = temp;
+        projection = &field->child;
+        path = dot + 1;
     }
-    arr->values[arr->num_values++] = value;
-    return 1;
 }
 
-static S_array_t *S_parse_array(S_ctx *ctx) {
-    S_array_t *arr;
-    S_value_t *value;
-    int       res;
+/*
+ * Skips the fields of an object that are not projected, up to
+ * the next kept field or the closing brace. Skipped values
+ * are only bracket matched.
+ */
+static int S_projection_skip_fields(S_ctx *ctx, S_projection_t **field) {
+    char   *name;
+    size_t len;
 
-    if (*ctx->ptr != '[') {
-        return NULL;
-    }
-    arr = S_array_create();
-    if (arr == NULL) {
-        return NULL;
-    }
+    *field = NULL;
     for (;;) {
-        S_skip_whitespace(ctx);
-        if (S_skip_over_if_possible(ctx) == 0) {
-            S_array_destroy(&arr);
-            return NULL;
+        if (ctx->ptr == ctx->end) {
+            return 0;
         }
-        if (*ctx->ptr == ']') {
-            break;
+        if (*ctx->ptr != '"') {
+            return 1; // Closing brace, or an error for the object parser
         }
-        value = S_parse_value(ctx);
-        if (value == NULL) {
-            S_array_destroy(&arr);
-            return NULL;
+        name = ctx->ptr + 1;
+        if (S_scan_string(ctx) == 0) {
+            return 0;
         }
-        res = S_array_emplace_value(arr, value);
-        if (res == 0) {
-            S_array_destroy(&arr);
-            return NULL;
+        len = ctx->ptr - name;
+        *field = S_projection_find(ctx->projection, name, len);
+        if (*field != NULL) {
+            ctx->ptr = name - 1;
+            return 1;
         }
+        ctx->ptr++;
         S_skip_whitespace(ctx);
-        if (*ctx->ptr == ']') {
-            break;
-        } else if (*ctx->ptr == ',') {
-            continue;
+        if (ctx->ptr == ctx->end || *ctx->ptr != ':') {
+            return 0;
         }
-        S_array_destroy(&arr);
-        return NULL;
+        S_skip_over_if_possible(ctx);
+        if (S_skip_value(ctx) == 0) {
+            return 0;
+        }
+        S_skip_whitespace(ctx);
+        if (ctx->ptr == ctx->end) {
+            return 0;
+        }
+        if (*ctx->ptr == '}') {
+            return 1;
+        }
+        if (*ctx->ptr != ',') {
+            return 0;
+        }
+        S_skip_over_if_possible(ctx);
     }
-    ctx->ptr++;
-    return arr;
 }
 
-static int S_write_array(S_write_ctx_t *ctx, S_array_t *arr) {
-    size_t i;
+/* ---------------------------------------------------- */
 
-    if (S_write_add_string(ctx, "[") == 0) {
-        return 0;
-    }
-    for (i = 0; i < arr->num_values - 1; i++) {
-        if (S_write_value(ctx, arr->values[i]) == 0) {
-            return 0;
+/* -------------------- UTF-8 -------------------- */
+
+/*
+ * Scalar validator, following the well-formed byte sequence
+ * table of the Unicode standard (Table 3-7). Runs of ASCII
+ * are consumed eight bytes at a time.
+ */
+static int S_utf8_validate_scalar(const unsigned char *s, size_t len) {
+    uint64_t word;
+    size_t   i;
+    unsigned char c;
+
+    i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            memcpy(&word, &s[i], 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
         }
-        if (S_write_add_string(ctx, ",") == 0) {
+        c = s[i];
+        if (c < 0x80) {
+            i++;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            if (i + 1 >= len || (s[i + 1] & 0xC0) != 0x80) {
+                return 0;
+            }
+            i += 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            if (i + 2 >= len || (s[i + 2] & 0xC0) != 0x80) {
+                return 0;
+            }
+            if ((c == 0xE0 && (s[i + 1] < 0xA0 || s[i + 1] > 0xBF))
+                    || (c == 0xED && (s[i + 1] < 0x80 || s[i + 1] > 0x9F))
+                    || (s[i + 1] & 0xC0) != 0x80) {
+                return 0;
+            }
+            i += 3;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            if (i + 3 >= len || (s[i + 2] & 0xC0) != 0x80
+                    || (s[i + 3] & 0xC0) != 0x80) {
+                return 0;
+            }
+            if ((c == 0xF0 && (s[i + 1] < 0x90 || s[i + 1] > 0xBF))
+                    || (c == 0xF4 && (s[i + 1] < 0x80 || s[i + 1] > 0x8F))
+                    || (s[i + 1] & 0xC0) != 0x80) {
+                return 0;
+            }
+            i += 4;
+        } else {
             return 0;
         }
     }
-    if (arr->num_values > 0 && S_write_value(ctx, arr->values[arr->num_values - 1]) == 0)  {
-        return 0;
-    }
-    if (S_write_add_string(ctx, "]") == 0) {
-        return 0;
-    }
     return 1;
 }
 
-/* ----------------------------------------------- */
+#ifdef S_HAVE_SSSE3_DISPATCH
 
-/* -------------------- Number -------------------- */
+/*
+ * Keiser & Lemire lookup validator ("Validating UTF-8 in less
+ * than one instruction per byte"). Each 16 byte block is
+ * classified with three nibble lookups, the error bits of
+ * which only survive for invalid sequences.
+ */
+#define S_UTF8_TOO_SHORT      (1 << 0)
+#define S_UTF8_TOO_LONG       (1 << 1)
+#define S_UTF8_OVERLONG_3     (1 << 2)
+#define S_UTF8_TOO_LARGE      (1 << 3)
+#define S_UTF8_SURROGATE      (1 << 4)
+#define S_UTF8_OVERLONG_2     (1 << 5)
+#define S_UTF8_TOO_LARGE_1000 (1 << 6)
+#define S_UTF8_OVERLONG_4     (1 << 6)
+#define S_UTF8_TWO_CONTS      (1 << 7)
+#define S_UTF8_CARRY          (S_UTF8_TOO_SHORT | S_UTF8_TOO_LONG | S_UTF8_TWO_CONTS)
 
-typedef struct {
-    S_value_t this_value;
-    double    value;
-} S_number_t;
+#define S_UTF8_TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p)      \
+    _mm_setr_epi8((char) (a), (char) (b), (char) (c), (char) (d),         \
+                  (char) (e), (char) (f), (char) (g), (char) (h),         \
+                  (char) (i), (char) (j), (char) (k), (char) (l),         \
+                  (char) (m), (char) (n), (char) (o), (char) (p))
 
-static S_number_t *S_number_create(void) {
-    S_number_t *num;
+__attribute__((target("ssse3")))
+static __m128i S_utf8_block_errors(__m128i input, __m128i prev_input) {
+    __m128i nibble, prev1, prev2, prev3, byte_1_high, byte_1_low, byte_2_high;
+    __m128i special, must23;
 
-    num = malloc(sizeof *num);
-    if (num == NULL) {
-        return NULL;
-    }
-    num->this_value.type = S_VALUE_TYPE_NUMBER;
-    num->value = 0.0;
-    return num;
-}
+    nibble = _mm_set1_epi8(0x0F);
+    prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    byte_1_high = _mm_shuffle_epi8(S_UTF8_TABLE(
+        S_UTF8_TOO_LONG, S_UTF8_TOO_LONG, S_UTF8_TOO_LONG, S_UTF8_TOO_LONG,
+        S_UTF8_TOO_LONG, S_UTF8_TOO_LONG, S_UTF8_TOO_LONG, S_UTF8_TOO_LONG,
+        S_UTF8_TWO_CONTS, S_UTF8_TWO_CONTS, S_UTF8_TWO_CONTS, S_UTF8_TWO_CONTS,
+        S_UTF8_TOO_SHORT | S_UTF8_OVERLONG_2,
+        S_UTF8_TOO_SHORT,
+        S_UTF8_TOO_SHORT | S_UTF8_OVERLONG_3 | S_UTF8_SURROGATE,
+        S_UTF8_TOO_SHORT | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000 | S_UTF8_OVERLONG_4),
+        _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    byte_1_low = _mm_shuffle_epi8(S_UTF8_TABLE(
+        S_UTF8_CARRY | S_UTF8_OVERLONG_3 | S_UTF8_OVERLONG_2 | S_UTF8_OVERLONG_4,
+        S_UTF8_CARRY | S_UTF8_OVERLONG_2,
+        S_UTF8_CARRY,
+        S_UTF8_CARRY,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000 | S_UTF8_SURROGATE,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000,
+        S_UTF8_CARRY | S_UTF8_TOO_LARGE | S_UTF8_TOO_LARGE_1000),
+        _mm_and_si128(prev1, nibble));
+    byte_2_high = _mm_shuffle_epi8(S_UTF8_TABLE(
+        S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT,
+        S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT,
+        S_UTF8_TOO_LONG | S_UTF8_OVERLONG_2 | S_UTF8_TWO_CONTS | S_UTF8_OVERLONG_3
+            | S_UTF8_TOO_LARGE_1000 | S_UTF8_OVERLONG_4,
+        S_UTF8_TOO_LONG | S_UTF8_OVERLONG_2 | S_UTF8_TWO_CONTS | S_UTF8_OVERLONG_3
+            | S_UTF8_TOO_LARGE,
+        S_UTF8_TOO_LONG | S_UTF8_OVERLONG_2 | S_UTF8_TWO_CONTS | S_UTF8_SURROGATE
+            | S_UTF8_TOO_LARGE,
+        S_UTF8_TOO_LONG | S_UTF8_OVERLONG_2 | S_UTF8_TWO_CONTS | S_UTF8_SURROGATE
+            | S_UTF8_TOO_LARGE,
+        S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT, S_UTF8_TOO_SHORT),
+        _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
 
-static int S_number_check_if_possible(char c) {
-    return S_ISDIGIT(c) || c == '-' || c == 'e' 
-        || c == 'E' || c == '.';
+    /* Third and fourth bytes of 3/4 byte sequences must be continuations */
+    prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char) 0xDF)),
+                          _mm_subs_epu8(prev3, _mm_set1_epi8((char) 0xEF)));
+    must23 = _mm_and_si128(_mm_cmpgt_epi8(must23, _mm_setzero_si128()),
+                           _mm_set1_epi8((char) 0x80));
+    return _mm_xor_si128(must23, special);
 }
 
-static S_number_t *S_parse_number(S_ctx *ctx) {
-    S_number_t *num;
-    char       *start;
+__attribute__((target("ssse3")))
+static int S_utf8_validate_ssse3(const unsigned char *s, size_t len) {
+    __m128i input, prev_input, error, prev_incomplete, max_value;
+    unsigned char tail[16];
+    size_t  i;
 
-    if (!S_number_check_if_possible(*ctx->ptr)) {
-        return NULL;
+    prev_input = _mm_setzero_si128();
+    prev_incomplete = _mm_setzero_si128();
+    error = _mm_setzero_si128();
+    max_value = S_UTF8_TABLE(255, 255, 255, 255, 255, 255, 255, 255,
+                             255, 255, 255, 255, 255, 0xEF, 0xDF, 0xBF);
+    for (i = 0; i < len; i += 16) {
+        if (i + 16 <= len) {
+            input = _mm_loadu_si128((const __m128i *) &s[i]);
+        } else {
+            memset(tail, 0, sizeof tail);
+            memcpy(tail, &s[i], len - i);
+            input = _mm_loadu_si128((const __m128i *) tail);
+        }
+        if (_mm_movemask_epi8(input) == 0) {
+            error = _mm_or_si128(error, prev_incomplete);
+        } else {
+            error = _mm_or_si128(error, S_utf8_block_errors(input, prev_input));
+            prev_incomplete = _mm_subs_epu8(input, max_value);
+        }
+        prev_input = input;
     }
-    num = S_number_create();
-    if (num == NULL) {
-        return NULL;
+    error = _mm_or_si128(error, prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+#endif
+
+static int S_utf8_validate(const char *s, size_t len) {
+#ifdef S_HAVE_SSSE3_DISPATCH
+    static int has_ssse3 = -1;
+
+    if (has_ssse3 < 0) {
+        has_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
     }
-    start = ctx->ptr;
-    while (S_number_check_if_possible(*ctx->ptr)) {
-        ctx->ptr++;
+    if (has_ssse3 && len >= 16) {
+        return S_utf8_validate_ssse3((const unsigned char *) s, len);
     }
-    num->value = strtod(start, &ctx->ptr);
-    return num;
+#endif
+    return S_utf8_validate_scalar((const unsigned char *) s, len);
 }
 
-static int S_write_number(S_write_ctx_t *ctx, S_number_t *num) {
+/* ----------------------------------------------- */
+
+/* -------------------- Value -------------------- */
+
+/*
+ * Values are 16 byte slots, stored by value in their parent
+ * container. Numbers, booleans, null and strings of up to
+ * S_VALUE_INLINE_MAX bytes live in the slot itself; longer
+ * strings, arrays and objects point to a body.
+ *
+ * Bodies are reference counted. A body referenced more than
+ * once is shared and must not be modified: it is copied first
+ * (see S_object_unshare). Bodies allocated by a parser have
+ * no count: they live until the parser is reused, and so do
+ * the bodies of an image (see S_image_open).
+ */
+#define S_VALUE_REFS_POOLED 0
+#define S_VALUE_INLINE_MAX  13   // Followed by a NUL, the bits and the type
+#define S_VALUE_LAYOUT      1    // Revision of the slot and body layouts, saved in images
+
+#define S_VALUE_BITS_LEN    0x0F // Length of an inline string
+#define S_VALUE_BITS_INLINE 0x10 // String stored in the slot
+#define S_VALUE_BITS_LAST   0x20 // Name of the last entry of an object
+#define S_VALUE_BITS_IMAGE  0x40 // Body pointer relative to the slot
+#define S_VALUE_BITS_LEXEME 0x80 // Number kept as text, inline or in a body
+
+#define S_LEXEME_INLINE_MAX  12  // Characters packed by two in the chars of a slot
+#define S_LEXEME_UNCONVERTED NAN // No JSON number converts to a NaN
+
+#define S_BODY_FLAG_IMAGE 0x01 // Pointers of the body are relative
+#define S_BODY_FLAG_ROOT  0x02 // Document held by the user, not by a slot
+
+/*
+ * Pointers stored in an image are offsets from their own
+ * address, so the image can be mapped at any address. 0
+ * stands for NULL.
+ */
+#define S_RELATIVE(field) ((intptr_t) (field) == 0 ? NULL \
+                              : (void *) ((char *) &(field) + (intptr_t) (field)))
+
+typedef struct {
+    unsigned int refs;
+    unsigned int flags;
+} S_body_t;
+
+typedef struct {
+    S_body_t body;
+    size_t   len;
+    char     data[];
+} S_string_t;
+
+/*
+ * Text of a number too long to be inline (see
+ * S_PARSE_FLAG_LAZY_NUMBERS), and its value once converted
+ * (S_LEXEME_UNCONVERTED until then).
+ */
+typedef struct {
+    S_body_t body;
+    double   value;
+    size_t   len;
+    char     data[];
+} S_lexeme_t;
+
+typedef struct s_S_value {
+    union {
+        double     number;
+        S_bool_t   boolean;
+        S_body_t   *body;
+        S_string_t *string;
+        S_array_t  *array;
+        S_object_t object;
+    } as;
+    char          chars[6]; // Rest of an inline string
+    unsigned char bits;
+    unsigned char type;
+} S_value_t;
+
+typedef char S_value_size_check[sizeof (S_value_t) == 16 ? 1 : -1];
+
+static int        S_parse_value(S_ctx *ctx, S_value_t *value);
+static int        S_parse_number_value(S_ctx *ctx, double *value);
+static int        S_number_check_if_possible(char c);
+static void       S_value_destroy(S_value_t *value);
+static int        S_write_value(S_write_ctx_t *ctx, S_value_t *val);
+static int        S_write_double(S_write_ctx_t *ctx, double value);
+
+static int S_ctx_push(S_ctx *ctx, S_value_t *value) {
+    S_value_t *temp;
+    size_t    size;
+
+    if (ctx->stack_len == ctx->stack_size) {
+        size = ctx->stack_size == 0 ? S_STACK_SIZE : 2 * ctx->stack_size;
+        temp = realloc(ctx->stack, sizeof *ctx->stack * size);
+        if (temp == NULL) {
+            return 0;
+        }
+        ctx->stack = temp;
+        ctx->stack_size = size;
+    }
+    ctx->stack[ctx->stack_len++] = *value;
+    return 1;
+}
+
+static void *S_body_create(S_ctx *ctx, size_t size) {
+    S_body_t *body;
+
+    body = S_ctx_alloc(ctx, size);
+    if (body == NULL) {
+        return NULL;
+    }
+    body->refs = ctx != NULL && ctx->parser != NULL ? S_VALUE_REFS_POOLED : 1;
+    body->flags = 0;
+    return body;
+}
+
+static int S_body_is_pooled(S_body_t *body) {
+    return S_ATOMIC_LOAD(&body->refs) == S_VALUE_REFS_POOLED;
+}
+
+static int S_value_has_body(S_value_t *value) {
+    return value->type == S_VALUE_TYPE_OBJECT || value->type == S_VALUE_TYPE_ARRAY
+        || (value->type == S_VALUE_TYPE_STRING && !(value->bits & S_VALUE_BITS_INLINE))
+        || (value->type == S_VALUE_TYPE_NUMBER
+            && (value->bits & (S_VALUE_BITS_LEXEME | S_VALUE_BITS_INLINE)) == S_VALUE_BITS_LEXEME);
+}
+
+static S_body_t *S_value_body(S_value_t *value) {
+    if (value->bits & S_VALUE_BITS_IMAGE) {
+        return S_RELATIVE(value->as.body);
+    }
+    return value->as.body;
+}
+
+static S_object_t S_value_object(S_value_t *value) {
+    return (S_object_t) S_value_body(value);
+}
+
+static S_array_t *S_value_array(S_value_t *value) {
+    return (S_array_t *) S_value_body(value);
+}
+
+static void S_value_retain(S_value_t *value) {
+    if (S_value_has_body(value) && !S_body_is_pooled(S_value_body(value))) {
+        S_ATOMIC_INC(&value->as.body->refs);
+    }
+}
+
+static void S_value_set_null(S_value_t *value) {
+    memset(value, 0, sizeof *value);
+    value->type = S_VALUE_TYPE_NULL;
+}
+
+static void S_value_set_bool(S_value_t *value, S_bool_t b) {
+    memset(value, 0, sizeof *value);
+    value->as.boolean = b ? 1 : 0;
+    value->type = S_VALUE_TYPE_BOOLEAN;
+}
+
+static void S_value_set_number(S_value_t *value, double number) {
+    memset(value, 0, sizeof *value);
+    value->as.number = number;
+    value->type = S_VALUE_TYPE_NUMBER;
+}
+
+static void S_value_set_array(S_value_t *value, S_array_t *arr) {
+    memset(value, 0, sizeof *value);
+    value->as.array = arr;
+    value->type = S_VALUE_TYPE_ARRAY;
+}
+
+static void S_value_set_object(S_value_t *value, S_object_t obj) {
+    memset(value, 0, sizeof *value);
+    value->as.object = obj;
+    value->type = S_VALUE_TYPE_OBJECT;
+}
+
+/*
+ * Serialized fragment cache of a container (array or object).
+ * A NULL cache marks the container as dirty. Fragments are
+ * published atomically, so shared containers can be written
+ * from several threads at once, and are only modified or
+ * freed by edits, which own the document.
+ *
+ * Fragments over S_WRITE_CACHE_MAX_SIZE bytes are cut in
+ * blocks of slots, written from the container instead of the
+ * fragment when live: a block holding a large child is left to
+ * the fragment of the child, and a block with a modified slot
+ * goes stale. The bytes of a container are then kept by its
+ * small ancestors only, and an edit costs the blocks on its
+ * path (see S_container_dirty).
+ */
+typedef struct s_S_fragment_block {
+    size_t slot; // First slot of the block
+    size_t at;   // Offset of its bytes in the fragment
+    int    live;
+} S_fragment_block_t;
+
+typedef struct {
+    size_t             len;
+    size_t             num_blocks; // 0 when written whole
+    size_t             num_stale;
+    size_t             last;       // Slot made stale last, see S_container_find
+    int                array;      // The container is an array, not an object
+    S_fragment_block_t *blocks;    // Followed by the end of the last block
+    char               data[];
+} S_fragment_t;
+
+#define S_WRITE_CACHE_BLOCK_SIZE  512
+#define S_WRITE_CACHE_STALE_RATIO 4            // Up to a quarter of the blocks stale
+#define S_WRITE_CACHE_SLOT_ALL    ((size_t) -1) // Slots added or removed
+
+static void S_cache_clear(S_fragment_t **cache) {
+    free(*cache);
+    *cache = NULL;
+}
+
+/*
+ * Head of arrays and objects. The parent is the container
+ * holding this one in a slot, or NULL when it is not known: it
+ * is set by the parser, deep copies and edits, and dropped when
+ * the parent releases the child. Shallow copies leave it on the
+ * original, so the children they share are not modifiable
+ * through the copy until they are edited. Parser owned arrays
+ * keep their parser instead (see S_array_slots).
+ */
+typedef struct s_S_container {
+    S_body_t                  body;
+    union {
+        struct s_S_container *parent; // Heap containers
+        S_parser_t           *parser; // Parser owned containers
+    } up;
+    S_fragment_t              *cache;
+} S_container_t;
+
+static void S_container_adopt(S_container_t *parent, S_value_t *value) {
+    if (value->type == S_VALUE_TYPE_OBJECT || value->type == S_VALUE_TYPE_ARRAY) {
+        ((S_container_t *) value->as.body)->up.parent = parent;
+    }
+}
+
+/*
+ * Makes sure the container is not reachable from another
+ * document: it and all its ancestors up to the root have to be
+ * referenced once. Only the root itself may be shared, as it is
+ * then copied by its holder (see S_object_unshare).
+ */
+static S_error_code_t S_container_check(S_container_t *node) {
+    if (node->body.flags & S_BODY_FLAG_ROOT) {
+        return S_ERROR_CODE_OK;
+    }
+    do {
+        if (S_ATOMIC_LOAD(&node->body.refs) != 1 || node->up.parent == NULL) {
+            return S_ERROR_CODE_READ_ONLY;
+        }
+        node = node->up.parent;
+    } while (!(node->body.flags & S_BODY_FLAG_ROOT));
+    return S_ATOMIC_LOAD(&node->body.refs) == 1 ? S_ERROR_CODE_OK : S_ERROR_CODE_READ_ONLY;
+}
+
+/*
+ * Releases a slot of the container, dropping the parent link of
+ * a child which may live on in a copy of the container.
+ */
+static void S_value_release(S_value_t *value, S_container_t *owner) {
+    S_container_t *expected;
+
+    if (value->type == S_VALUE_TYPE_OBJECT || value->type == S_VALUE_TYPE_ARRAY) {
+        expected = owner;
+        S_ATOMIC_CAS(&((S_container_t *) value->as.body)->up.parent, &expected, NULL);
+    }
+    S_value_destroy(value);
+}
+
+static int S_write_container(S_write_ctx_t *ctx, S_container_t *node, int array, size_t count);
+
+/* ----------------------------------------------- */
+
+/* -------------------- String -------------------- */
+
+/*
+ * Stores a string in the slot when short enough, in a body
+ * holding its bytes otherwise. Strings are NUL terminated
+ * either way.
+ */
+static int S_value_set_string(S_ctx *ctx, S_value_t *value, const char *s, size_t len) {
+    S_string_t *str;
+
+    memset(value, 0, sizeof *value);
+    value->type = S_VALUE_TYPE_STRING;
+    if (len <= S_VALUE_INLINE_MAX) {
+        memcpy((char *) value, s, len);
+        value->bits = S_VALUE_BITS_INLINE | (unsigned char) len;
+        return 1;
+    }
+    str = S_body_create(ctx, sizeof *str + len + 1);
+    if (str == NULL) {
+        return 0;
+    }
+    str->len = len;
+    memcpy(str->data, s, len);
+    str->data[len] = '\0';
+    value->as.string = str;
+    return 1;
+}
+
+static const char *S_value_string(S_value_t *value, size_t *len) {
+    S_string_t *str;
+
+    if (value->bits & S_VALUE_BITS_INLINE) {
+        *len = value->bits & S_VALUE_BITS_LEN;
+        return (const char *) value;
+    }
+    str = (S_string_t *) S_value_body(value);
+    *len = str->len;
+    return str->data;
+}
+
+static int S_parse_string(S_ctx *ctx, S_value_t *value) {
+    char *start;
+
+    if (*ctx->ptr != '"') {
+        return 0;
+    }
+    start = ctx->ptr + 1;
+    if (S_scan_string(ctx) == 0) {
+        return 0;
+    }
+    if ((ctx->flags & S_PARSE_FLAG_VALIDATE_UTF8)
+            && S_utf8_validate(start, ctx->ptr - start) == 0) {
+        return 0;
+    }
+    if (S_value_set_string(ctx, value, start, ctx->ptr - start) == 0) {
+        return 0;
+    }
+    ctx->ptr++;
+    return 1;
+}
+
+static int S_write_string(S_write_ctx_t *ctx, S_value_t *str) {
+    const char *data;
+    size_t     len;
+
+    data = S_value_string(str, &len);
+    if (S_write_add_string(ctx, "\"") == 0) {
+        return 0;
+    }
+    if (S_write_add_bytes(ctx, data, len) == 0) {
+        return 0;
+    }
+    if (S_write_add_string(ctx, "\"") == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------ */
+
+/* -------------------- Array -------------------- */
+
+/*
+ * Arrays holding only numbers are packed: the numbers are
+ * stored in place of the values, which are then NULL.
+ */
+struct s_S_array {
+    S_container_t base;
+    S_value_t     *values;
+    double        *numbers;
+    size_t        num_values;
+    size_t        size;
+};
+
+static S_array_t *S_array_create(S_ctx *ctx) {
+    S_array_t *arr;
+
+    arr = S_body_create(ctx, sizeof *arr);
+    if (arr == NULL) {
+        return NULL;
+    }
+    arr->num_values = 0;
+    arr->size = 0;
+    arr->values = NULL;
+    arr->numbers = NULL;
+    if (ctx != NULL && ctx->parser != NULL) {
+        arr->base.up.parser = ctx->parser;
+    } else {
+        arr->base.up.parent = NULL;
+    }
+    arr->base.cache = NULL;
+    return arr;
+}
+
+/*
+ * Packed arrays get their slots concurrently (S_array_slots),
+ * so the pointer is loaded atomically.
+ */
+static S_value_t *S_array_values(S_array_t *arr) {
+    if (arr->base.body.flags & S_BODY_FLAG_IMAGE) {
+        return S_RELATIVE(arr->values);
+    }
+    return S_ATOMIC_LOAD(&arr->values);
+}
+
+static double *S_array_numbers(S_array_t *arr) {
+    if (arr->base.body.flags & S_BODY_FLAG_IMAGE) {
+        return S_RELATIVE(arr->numbers);
+    }
+    return arr->numbers;
+}
+
+/*
+ * Returns the slots of an array. A packed array gets its slots
+ * on first use, which are published atomically as documents are
+ * read from several threads, and freed with the array (or the
+ * parser owning it). Images store them along with the numbers.
+ */
+static S_value_t *S_array_slots(S_array_t *arr) {
+    S_arena_block_t *block;
+    S_value_t       *values;
+    S_value_t       *expected;
+    double          *numbers;
+    size_t          i;
+
+    numbers = S_array_numbers(arr);
+    if (numbers == NULL || (arr->base.body.flags & S_BODY_FLAG_IMAGE)) {
+        return S_array_values(arr);
+    }
+    values = S_ATOMIC_LOAD(&arr->values);
+    if (values != NULL) {
+        return values;
+    }
+    block = NULL;
+    if (S_body_is_pooled(&arr->base.body)) {
+        block = S_arena_block_create(sizeof *values * arr->num_values);
+        values = block == NULL ? NULL : (S_value_t *) block->data;
+    } else {
+        values = malloc(sizeof *values * arr->num_values);
+    }
+    if (values == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < arr->num_values; i++) {
+        S_value_set_number(&values[i], numbers[i]);
+    }
+    expected = NULL;
+    if (!S_ATOMIC_CAS(&arr->values, &expected, values)) {
+        if (block != NULL) {
+            free(block);
+        } else {
+            free(values);
+        }
+        return expected; // Built concurrently by another thread
+    }
+    if (block != NULL) {
+        S_arena_keep(arr->base.up.parser, block);
+    }
+    return values;
+}
+
+static void S_array_destroy(S_array_t **arr) {
+    size_t i;
+
+    S_cache_clear(&(*arr)->base.cache);
+    free((*arr)->numbers);
+    for (i = 0; (*arr)->values != NULL && i < (*arr)->num_values; i++) {
+        S_value_release(&(*arr)->values[i], &(*arr)->base);
+    }
+    free((*arr)->values);
+    free(*arr);
+    *arr = NULL;
+}
+
+/*
+ * Elements are collected on the scratch stack of the context,
+ * shared by all nesting levels, and moved into an array of the
+ * exact size once the closing bracket is reached. Numbers are
+ * collected unboxed on a second stack for as long as no other
+ * value is found, so that all-number arrays end up packed.
+ */
+static int S_parse_array(S_ctx *ctx, S_value_t *out) {
+    S_array_t *arr;
+    S_value_t value;
+    double    number;
+    size_t    base;
+    size_t    nums_base;
+    size_t    i;
+    int       packed;
+
+    if (*ctx->ptr != '[') {
+        return 0;
+    }
+    base = ctx->stack_len;
+    nums_base = ctx->nums_len;
+    packed = !(ctx->flags & S_PARSE_FLAG_LAZY_NUMBERS); // Packed numbers have no text
+    for (;;) {
+        S_skip_whitespace(ctx);
+        if (S_skip_over_if_possible(ctx) == 0 || ctx->ptr == ctx->end) {
+            goto error;
+        }
+        if (*ctx->ptr == ']') {
+            break;
+        }
+        if (packed && S_number_check_if_possible(*ctx->ptr)) {
+            if (S_parse_number_value(ctx, &number) == 0
+                    || S_ctx_push_number(ctx, number) == 0) {
+                goto error;
+            }
+        } else {
+            if (packed) {
+                packed = 0; // Move the numbers read so far into slots
+                for (i = nums_base; i < ctx->nums_len; i++) {
+                    S_value_set_number(&value, ctx->nums[i]);
+                    if (S_ctx_push(ctx, &value) == 0) {
+                        goto error;
+                    }
+                }
+                ctx->nums_len = nums_base;
+            }
+            if (S_parse_value(ctx, &value) == 0) {
+                goto error;
+            }
+            if (S_ctx_push(ctx, &value) == 0) {
+                S_value_destroy(&value);
+                goto error;
+            }
+        }
+        S_skip_whitespace(ctx);
+        if (ctx->ptr == ctx->end) {
+            goto error;
+        }
+        if (*ctx->ptr == ']') {
+            break;
+        } else if (*ctx->ptr == ',') {
+            continue;
+        }
+        goto error;
+    }
+    arr = S_array_create(ctx);
+    if (arr == NULL) {
+        goto error;
+    }
+    if (packed && ctx->nums_len > nums_base) {
+        arr->num_values = ctx->nums_len - nums_base;
+        arr->numbers = S_ctx_alloc(ctx, sizeof *arr->numbers * arr->num_values);
+        if (arr->numbers == NULL) {
+            arr->num_values = 0;
+            if (ctx->parser == NULL) {
+                S_array_destroy(&arr);
+            }
+            goto error;
+        }
+        memcpy(arr->numbers, &ctx->nums[nums_base], sizeof *arr->numbers * arr->num_values);
+    } else if (ctx->stack_len > base) {
+        arr->num_values = ctx->stack_len - base;
+        arr->values = S_ctx_alloc(ctx, sizeof *arr->values * arr->num_values);
+        if (arr->values == NULL) {
+            arr->num_values = 0;
+            if (ctx->parser == NULL) {
+                S_array_destroy(&arr);
+            }
+            goto error;
+        }
+        memcpy(arr->values, &ctx->stack[base], sizeof *arr->values * arr->num_values);
+        for (i = 0; ctx->parser == NULL && i < arr->num_values; i++) {
+            S_container_adopt(&arr->base, &arr->values[i]);
+        }
+    }
+    arr->size = arr->num_values;
+    ctx->stack_len = base;
+    ctx->nums_len = nums_base;
+    ctx->ptr++;
+    S_value_set_array(out, arr);
+    return 1;
+error:
+    for (i = base; i < ctx->stack_len; i++) {
+        S_value_destroy(&ctx->stack[i]);
+    }
+    ctx->stack_len = base;
+    ctx->nums_len = nums_base;
+    return 0;
+}
+
+/*
+ * Writes the elements [begin, end) with their separators, so
+ * consecutive ranges can be concatenated.
+ */
+static int S_write_array_values(S_write_ctx_t *ctx, S_array_t *arr, size_t begin, size_t end) {
+    S_value_t *values;
+    double    *numbers;
+    size_t    i;
+    int       res;
+
+    numbers = S_array_numbers(arr);
+    values = numbers == NULL ? S_array_values(arr) : NULL;
+    for (i = begin; i < end; i++) {
+        if (i > 0 && S_write_add_string(ctx, ",") == 0) {
+            return 0;
+        }
+        if (numbers != NULL) {
+            res = S_write_double(ctx, numbers[i]);
+        } else {
+            res = S_write_value(ctx, &values[i]);
+        }
+        if (res == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int S_write_array(S_write_ctx_t *ctx, S_array_t *arr) {
+    return S_write_container(ctx, &arr->base, 1, arr->num_values);
+}
+
+/* ----------------------------------------------- */
+
+/* -------------------- Number -------------------- */
+
+static int S_number_check_if_possible(char c) {
+    return S_ISDIGIT(c) || c == '-' || c == 'e'
+        || c == 'E' || c == '.';
+}
+
+/*
+ * Converts the len bytes of a scanned number. The number may
+ * end the buffer, which strtod would read past: it is given a
+ * NUL terminated copy.
+ */
+static int S_number_convert(const char *s, size_t len, double *value) {
+    char buf[S_NUMBER_BUF_SIZE];
+    char *copy;
+
+    copy = len < sizeof buf ? buf : malloc(len + 1);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    *value = strtod(copy, NULL);
+    if (copy != buf) {
+        free(copy);
+    }
+    return 1;
+}
+
+static int S_parse_number_value(S_ctx *ctx, double *value) {
+    char *start;
+
+    start = ctx->ptr;
+    if (S_scan_number(ctx) == 0) {
+        return 0;
+    }
+    return S_number_convert(start, ctx->ptr - start, value);
+}
+
+/*
+ * Characters of a number, as packed in an inline lexeme.
+ */
+static const char S_lexeme_chars[16] = "0123456789+-.eE";
+
+static unsigned int S_lexeme_code(char c) {
+    switch (c) {
+        case '+':
+            return 10;
+        case '-':
+            return 11;
+        case '.':
+            return 12;
+        case 'e':
+            return 13;
+        case 'E':
+            return 14;
+        default:
+            return c - '0';
+    }
+}
+
+/*
+ * Keeps the text of a number, otherwise in a lexeme body. Short
+ * numbers are inline: their characters are packed two per byte
+ * in the chars of the slot, leaving room for the value once
+ * converted.
+ */
+static int S_value_set_lexeme(S_ctx *ctx, S_value_t *value, const char *s, size_t len) {
+    S_lexeme_t *lex;
+    size_t     i;
+
+    if (len <= S_LEXEME_INLINE_MAX) {
+        memset(value, 0, sizeof *value);
+        for (i = 0; i < len; i++) {
+            value->chars[i / 2] |= (char) (S_lexeme_code(s[i]) << (i % 2 * 4));
+        }
+        value->as.number = S_LEXEME_UNCONVERTED;
+        value->bits = S_VALUE_BITS_LEXEME | S_VALUE_BITS_INLINE | (unsigned char) len;
+        value->type = S_VALUE_TYPE_NUMBER;
+        return 1;
+    }
+    lex = S_body_create(ctx, sizeof *lex + len + 1);
+    if (lex == NULL) {
+        return 0;
+    }
+    lex->value = S_LEXEME_UNCONVERTED;
+    lex->len = len;
+    memcpy(lex->data, s, len);
+    lex->data[len] = '\0';
+    memset(value, 0, sizeof *value);
+    value->as.body = &lex->body;
+    value->bits = S_VALUE_BITS_LEXEME;
+    value->type = S_VALUE_TYPE_NUMBER;
+    return 1;
+}
+
+/*
+ * Text of a lexeme, unpacked into buf (of S_LEXEME_INLINE_MAX + 1
+ * bytes) when inline.
+ */
+static const char *S_value_lexeme(S_value_t *value, char *buf, size_t *len) {
+    S_lexeme_t *lex;
+    size_t     i;
+
+    if (value->bits & S_VALUE_BITS_INLINE) {
+        *len = value->bits & S_VALUE_BITS_LEN;
+        for (i = 0; i < *len; i++) {
+            buf[i] = S_lexeme_chars[(unsigned char) value->chars[i / 2] >> (i % 2 * 4) & 0x0F];
+        }
+        buf[*len] = '\0';
+        return buf;
+    }
+    lex = (S_lexeme_t *) S_value_body(value);
+    *len = lex->len;
+    return lex->data;
+}
+
+/*
+ * Value of a number slot. Lexemes are converted on the first
+ * call and keep the result, in the slot or in the body, set
+ * atomically as the document may be read from several threads.
+ */
+static double S_value_number(S_value_t *value) {
+    S_lexeme_t *lex;
+    const char *data;
+    double     *cached;
+    double     number;
+    char       buf[S_LEXEME_INLINE_MAX + 1];
+    size_t     len;
+
+    if (!(value->bits & S_VALUE_BITS_LEXEME)) {
+        return value->as.number;
+    }
+    if (value->bits & S_VALUE_BITS_INLINE) {
+        cached = &value->as.number;
+    } else {
+        lex = (S_lexeme_t *) S_value_body(value);
+        cached = &lex->value;
+    }
+    S_ATOMIC_GET(cached, &number);
+    if (!isnan(number)) {
+        return number;
+    }
+    data = S_value_lexeme(value, buf, &len);
+    if (S_number_convert(data, len, &number) == 0) {
+        return NAN; // Not kept, converted again on the next call
+    }
+    S_ATOMIC_SET(cached, &number);
+    return number;
+}
+
+/*
+ * Copies a slot which may be read concurrently: the value of an
+ * inline lexeme is set by its first reader.
+ */
+static void S_value_copy_slot(S_value_t *copy, S_value_t *value) {
+    if (value->type == S_VALUE_TYPE_NUMBER && (value->bits & S_VALUE_BITS_INLINE)) {
+        memcpy(copy->chars, value->chars, sizeof copy->chars);
+        copy->bits = value->bits;
+        copy->type = value->type;
+        S_ATOMIC_GET(&value->as.number, &copy->as.number);
+        return;
+    }
+    *copy = *value;
+}
+
+static int S_parse_number(S_ctx *ctx, S_value_t *value) {
+    double number;
+    char   *start;
+
+    if (ctx->flags & S_PARSE_FLAG_LAZY_NUMBERS) {
+        start = ctx->ptr;
+        if (S_scan_number(ctx) == 0) {
+            return 0;
+        }
+        return S_value_set_lexeme(ctx, value, start, ctx->ptr - start);
+    }
+    if (S_parse_number_value(ctx, &number) == 0) {
+        return 0;
+    }
+    S_value_set_number(value, number);
+    return 1;
+}
+
+/*
+ * Canonical numbers: integers without a fractional part, other
+ * values with the fewest significant digits reading back as
+ * the same double.
+ */
+static int S_write_double_canonical(S_write_ctx_t *ctx, double value) {
+    char buf[32];
+    int  precision;
+    int  n;
+
+    if (value != value || value - value != 0.0) {
+        return S_write_add_string(ctx, "null"); // NaN and infinities
+    }
+    if (value == 0.0) {
+        return S_write_add_string(ctx, "0"); // Including -0
+    }
+    if (fabs(value) < 9007199254740992.0 && value == (double) (int64_t) value) {
+        n = snprintf(buf, sizeof buf, "%.0f", value);
+        return S_write_add_bytes(ctx, buf, n);
+    }
+    for (precision = 15; precision < 17; precision++) {
+        n = snprintf(buf, sizeof buf, "%.*g", precision, value);
+        if (strtod(buf, NULL) == value) {
+            return S_write_add_bytes(ctx, buf, n);
+        }
+    }
+    n = snprintf(buf, sizeof buf, "%.17g", value);
+    return S_write_add_bytes(ctx, buf, n);
+}
+
+static int S_write_double(S_write_ctx_t *ctx, double value) {
+    char buf[64];
     char *s;
     int  n;
+    int  res;
+
+    if (ctx->canonical) {
+        return S_write_double_canonical(ctx, value);
+    }
+    n = snprintf(buf, sizeof buf, S_WRITE_NUMBER_FORMAT, value);
+    if (n < 0) {
+        return 0;
+    }
+    if ((size_t) n < sizeof buf) {
+        return S_write_add_bytes(ctx, buf, n);
+    }
+    s = malloc(n + 1); // Only very large magnitudes
+    if (s == NULL) {
+        return 0;
+    }
+    snprintf(s, n + 1, S_WRITE_NUMBER_FORMAT, value);
+    res = S_write_add_bytes(ctx, s, n);
+    free(s);
+    return res;
+}
+
+/*
+ * Lexemes are copied verbatim, except in the canonical form.
+ */
+static int S_write_number(S_write_ctx_t *ctx, S_value_t *value) {
+    const char *data;
+    char       buf[S_LEXEME_INLINE_MAX + 1];
+    size_t     len;
+
+    if ((value->bits & S_VALUE_BITS_LEXEME) && !ctx->canonical) {
+        data = S_value_lexeme(value, buf, &len);
+        return S_write_add_bytes(ctx, data, len);
+    }
+    return S_write_double(ctx, S_value_number(value));
+}
+
+/* ------------------------------------------------ */
+
+/* -------------------- Boolean -------------------- */
+
+static int S_parse_boolean(S_ctx *ctx, S_value_t *value) {
+    if (S_scan_literal(ctx, "true", 4)) {
+        S_value_set_bool(value, 1);
+    } else if (S_scan_literal(ctx, "false", 5)) {
+        S_value_set_bool(value, 0);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int S_write_boolean(S_write_ctx_t *ctx, S_value_t *b) {
+    if (b->as.boolean == 1) {
+        if (S_write_add_string(ctx, "true") == 0) {
+            return 0;
+        }
+        return 1;
+    } else if (b->as.boolean == 0) {
+        if (S_write_add_string(ctx, "false") == 0) {
+            return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------- */
+
+/* -------------------- Null -------------------- */
+
+static int S_parse_null(S_ctx *ctx, S_value_t *value) {
+    if (S_scan_literal(ctx, "null", 4) == 0) {
+        return 0;
+    }
+    S_value_set_null(value);
+    return 1;
+}
+
+static int S_write_null(S_write_ctx_t *ctx) {
+    if (S_write_add_string(ctx, "null") == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/* -------------------- Object -------------------- */
+
+/*
+ * Fields are stored in document order, as pairs of slots. The
+ * name of the last one is marked, so entries can be iterated
+ * without their object.
+ */
+struct s_S_object_entry {
+    S_value_t name;
+    S_value_t value;
+};
+
+struct s_S_object {
+    S_container_t    base;
+    S_object_entry_t *entries;
+    size_t           num_entries;
+    size_t           size;
+};
+
+typedef char S_object_entry_size_check[sizeof (S_object_entry_t) == 2 * sizeof (S_value_t) ? 1 : -1];
+
+static S_object_t S_object_create(S_ctx *ctx) {
+    S_object_t obj;
+
+    obj = S_body_create(ctx, sizeof *obj);
+    if (obj == NULL) {
+        return NULL;
+    }
+    obj->entries = NULL;
+    obj->num_entries = 0;
+    obj->size = 0;
+    obj->base.up.parent = NULL;
+    obj->base.cache = NULL;
+    return obj;
+}
+
+static S_object_entry_t *S_object_entries(S_object_t obj) {
+    if (obj->base.body.flags & S_BODY_FLAG_IMAGE) {
+        return S_RELATIVE(obj->entries);
+    }
+    return obj->entries;
+}
+
+static void S_object_destroy(S_object_t *obj) {
+    size_t i;
+
+    S_cache_clear(&(*obj)->base.cache);
+    for (i = 0; i < (*obj)->num_entries; i++) {
+        S_value_destroy(&(*obj)->entries[i].name);
+        S_value_release(&(*obj)->entries[i].value, &(*obj)->base);
+    }
+    free((*obj)->entries);
+    free(*obj);
+    *obj = NULL;
+}
+
+static int S_object_entry_name_equals(S_object_entry_t *entry, const char *name, size_t len) {
+    const char *data;
+    size_t     data_len;
+
+    data = S_value_string(&entry->name, &data_len);
+    return data_len == len && memcmp(data, name, len) == 0;
+}
+
+/*
+ * Fields are collected on the scratch stack, name slot then
+ * value slot, and moved into the entries of the object once
+ * the closing brace is reached.
+ */
+static int S_parse_object(S_ctx *ctx, S_value_t *out) {
+    S_object_t     obj;
+    S_projection_t *projection;
+    S_projection_t *field;
+    S_value_t      value;
+    size_t         base;
+    size_t         i;
+    int            res;
+
+    base = ctx->stack_len;
+    projection = ctx->projection;
+    for (;;) {
+        if (S_skip_over_if_possible(ctx) == 0) {
+            goto error;
+        }
+        field = NULL;
+        if (projection != NULL && S_projection_skip_fields(ctx, &field) == 0) {
+            goto error;
+        }
+        if (ctx->ptr == ctx->end) {
+            goto error;
+        }
+        if (*ctx->ptr == '}') {
+            break; // Empty, or only skipped fields or a trailing comma left
+        }
+        if (S_parse_string(ctx, &value) == 0) {
+            goto error;
+        }
+        if (S_ctx_push(ctx, &value) == 0) {
+            S_value_destroy(&value);
+            goto error;
+        }
+        S_skip_whitespace(ctx);
+        if (ctx->ptr == ctx->end || *ctx->ptr != ':') {
+            goto error;
+        }
+        if (S_skip_over_if_possible(ctx) == 0) {
+            goto error;
+        }
+        if (field != NULL) {
+            ctx->projection = field->child; // Arrays pass it on to their elements
+        }
+        res = S_parse_value(ctx, &value);
+        ctx->projection = projection;
+        if (res == 0) {
+            goto error;
+        }
+        if (S_ctx_push(ctx, &value) == 0) {
+            S_value_destroy(&value);
+            goto error;
+        }
+        S_skip_whitespace(ctx);
+        if (ctx->ptr == ctx->end) {
+            goto error;
+        }
+        if (*ctx->ptr == '}') {
+            break;
+        } else if (*ctx->ptr != ',') {
+            goto error;
+        }
+    }
+    obj = S_object_create(ctx);
+    if (obj == NULL) {
+        goto error;
+    }
+    if (ctx->stack_len > base) {
+        obj->num_entries = (ctx->stack_len - base) / 2;
+        obj->entries = S_ctx_alloc(ctx, sizeof *obj->entries * obj->num_entries);
+        if (obj->entries == NULL) {
+            obj->num_entries = 0;
+            if (ctx->parser == NULL) {
+                S_object_destroy(&obj);
+            }
+            goto error;
+        }
+        memcpy(obj->entries, &ctx->stack[base], sizeof *obj->entries * obj->num_entries);
+        for (i = 0; ctx->parser == NULL && i < obj->num_entries; i++) {
+            S_container_adopt(&obj->base, &obj->entries[i].value);
+        }
+        obj->entries[obj->num_entries - 1].name.bits |= S_VALUE_BITS_LAST;
+    }
+    obj->size = obj->num_entries;
+    ctx->stack_len = base;
+    ctx->ptr++;
+    S_value_set_object(out, obj);
+    return 1;
+error:
+    for (i = base; i < ctx->stack_len; i++) {
+        S_value_destroy(&ctx->stack[i]);
+    }
+    ctx->stack_len = base;
+    return 0;
+}
+
+static int S_object_compare_names(const void *a, const void *b) {
+    S_object_entry_t *x;
+    S_object_entry_t *y;
+    const char       *x_data;
+    const char       *y_data;
+    size_t           x_len;
+    size_t           y_len;
+    int              res;
+
+    x = *(S_object_entry_t *const *) a;
+    y = *(S_object_entry_t *const *) b;
+    x_data = S_value_string(&x->name, &x_len);
+    y_data = S_value_string(&y->name, &y_len);
+    res = memcmp(x_data, y_data, x_len < y_len ? x_len : y_len);
+    if (res != 0) {
+        return res;
+    }
+    if (x_len != y_len) {
+        return x_len < y_len ? -1 : 1;
+    }
+    return x < y ? -1 : 1; // Duplicates
+}
+
+/*
+ * Writes an object with its fields sorted by name, for the
+ * canonical form.
+ */
+static int S_write_object_sorted(S_write_ctx_t *ctx, S_object_t obj) {
+    S_object_entry_t **entries;
+    size_t           i;
+    int              res;
+
+    entries = malloc(sizeof *entries * (obj->num_entries + 1));
+    if (entries == NULL) {
+        return 0;
+    }
+    for (i = 0; i < obj->num_entries; i++) {
+        entries[i] = &S_object_entries(obj)[i];
+    }
+    qsort(entries, obj->num_entries, sizeof *entries, S_object_compare_names);
+    res = S_write_add_string(ctx, "{");
+    for (i = 0; res && i < obj->num_entries; i++) {
+        res = (i == 0 || S_write_add_string(ctx, ","))
+            && S_write_string(ctx, &entries[i]->name)
+            && S_write_add_string(ctx, ":")
+            && S_write_value(ctx, &entries[i]->value);
+    }
+    free(entries);
+    return res && S_write_add_string(ctx, "}");
+}
+
+static int S_write_object_entries(S_write_ctx_t *ctx, S_object_t obj, size_t begin, size_t end) {
+    S_object_entry_t *entries;
+    size_t           i;
+
+    entries = S_object_entries(obj);
+    for (i = begin; i < end; i++) {
+        if (i > 0 && S_write_add_string(ctx, ",") == 0) {
+            return 0;
+        }
+        if (S_write_string(ctx, &entries[i].name) == 0) {
+            return 0;
+        }
+        if (S_write_add_string(ctx, ":") == 0) {
+            return 0;
+        }
+        if (S_write_value(ctx, &entries[i].value) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int S_write_object(S_write_ctx_t *ctx, S_object_t obj) {
+    if (ctx->canonical) {
+        return S_write_object_sorted(ctx, obj);
+    }
+    return S_write_container(ctx, &obj->base, 0, obj->num_entries);
+}
+
+/* ------------------------------------------------ */
+
+/* -------------------- Write cache -------------------- */
+
+/*
+ * Returns the container held in a slot, if any.
+ */
+static S_container_t *S_container_slot(S_container_t *node, int array, size_t i) {
+    S_value_t *value;
+
+    if (array) {
+        if (S_array_numbers((S_array_t *) node) != NULL) {
+            return NULL; // Packed numbers
+        }
+        value = &S_array_values((S_array_t *) node)[i];
+    } else {
+        value = &S_object_entries((S_object_t) node)[i].value;
+    }
+    if (value->type != S_VALUE_TYPE_OBJECT && value->type != S_VALUE_TYPE_ARRAY) {
+        return NULL;
+    }
+    return (S_container_t *) S_value_body(value);
+}
+
+static int S_write_slots(S_write_ctx_t *ctx, S_container_t *node, int array, size_t begin, size_t end) {
+    if (array) {
+        return S_write_array_values(ctx, (S_array_t *) node, begin, end);
+    }
+    return S_write_object_entries(ctx, (S_object_t) node, begin, end);
+}
+
+/*
+ * Writes the cached fragment if there is one, and its live
+ * blocks from the container. Returns -1 when the container is
+ * dirty and has to be serialized.
+ */
+static int S_cache_write(S_write_ctx_t *ctx, S_container_t *node) {
+    S_fragment_block_t *block;
+    S_fragment_t       *frag;
+    size_t             at;
+    size_t             i;
+
+    if (ctx->canonical) {
+        return -1;
+    }
+    frag = S_ATOMIC_LOAD(&node->cache);
+    if (frag == NULL) {
+        return -1;
+    }
+    at = 0;
+    for (i = 0; i < frag->num_blocks; i++) {
+        block = &frag->blocks[i];
+        if (!block->live) {
+            continue; // Copied along with the next live block
+        }
+        if (S_write_add_bytes(ctx, &frag->data[at], block->at - at) == 0
+                || S_write_slots(ctx, node, frag->array, block->slot, block[1].slot) == 0) {
+            return 0;
+        }
+        at = block[1].at;
+    }
+    return S_write_add_bytes(ctx, &frag->data[at], frag->len - at);
+}
+
+static int S_cache_block_push(S_write_ctx_t *ctx, size_t slot, size_t at, int live) {
+    S_fragment_block_t *temp;
+    size_t             size;
+
+    if (ctx->num_blocks == ctx->blocks_size) {
+        size = ctx->blocks_size == 0 ? S_STACK_SIZE : 2 * ctx->blocks_size;
+        temp = realloc(ctx->blocks, sizeof *temp * size);
+        if (temp == NULL) {
+            return 0;
+        }
+        ctx->blocks = temp;
+        ctx->blocks_size = size;
+    }
+    ctx->blocks[ctx->num_blocks].slot = slot;
+    ctx->blocks[ctx->num_blocks].at = at;
+    ctx->blocks[ctx->num_blocks].live = live;
+    ctx->num_blocks++;
+    return 1;
+}
+
+/*
+ * Writes the slots of a container one at a time, cutting them
+ * in blocks on the scratch stack of the context from base:
+ * a block ends after S_WRITE_CACHE_BLOCK_SIZE bytes, and a
+ * child with blocks of its own gets a live block. The last
+ * block pushed ends the slots.
+ */
+static int S_cache_write_blocks(S_write_ctx_t *ctx, S_container_t *node, int array, size_t count, size_t start) {
+    S_fragment_block_t *block;
+    S_container_t      *child;
+    S_fragment_t       *frag;
+    size_t             before;
+    size_t             i;
+
+    if (S_cache_block_push(ctx, 0, ctx->len - start, 0) == 0) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        before = ctx->len;
+        if (S_write_slots(ctx, node, array, i, i + 1) == 0) {
+            return 0;
+        }
+        block = &ctx->blocks[ctx->num_blocks - 1];
+        child = S_container_slot(node, array, i);
+        frag = child == NULL ? NULL : S_ATOMIC_LOAD(&child->cache);
+        if (frag != NULL && frag->num_blocks > 0) {
+            if (block->slot < i && S_cache_block_push(ctx, i, before - start, 1) == 0) {
+                return 0;
+            }
+            ctx->blocks[ctx->num_blocks - 1].live = 1;
+        } else if (ctx->len - start - block->at < S_WRITE_CACHE_BLOCK_SIZE) {
+            continue;
+        }
+        if (S_cache_block_push(ctx, i + 1, ctx->len - start, 0) == 0) {
+            return 0;
+        }
+    }
+    if (ctx->blocks[ctx->num_blocks - 1].slot == count) {
+        return 1;
+    }
+    return S_cache_block_push(ctx, count, ctx->len - start, 0);
+}
+
+/*
+ * Keeps the bytes written since start as the container fragment,
+ * with the blocks from base when it is large. The bytes of live
+ * blocks are not kept. Small fragments are cheaper to
+ * re-serialize than to keep.
+ */
+static void S_cache_store(S_write_ctx_t *ctx, S_container_t *node, int array, size_t start, size_t base) {
+    S_fragment_block_t *blocks;
+    S_fragment_t       *frag;
+    S_fragment_t       *expected;
+    size_t             num_blocks;
+    size_t             size;
+    size_t             len;
+    size_t             at;
+    size_t             i;
+
+    if (ctx->canonical || (ctx->split_at != 0 && start < ctx->split_at)) {
+        return; // Containers around a split are incomplete
+    }
+    len = ctx->len - start;
+    if (len < S_WRITE_CACHE_MIN_SIZE || S_body_is_pooled(&node->body)) {
+        return;
+    }
+    blocks = &ctx->blocks[base];
+    num_blocks = len > S_WRITE_CACHE_MAX_SIZE && ctx->num_blocks > base ? ctx->num_blocks - base - 1 : 0;
+    size = len;
+    for (i = 0; i < num_blocks; i++) {
+        if (blocks[i].live) {
+            size -= blocks[i + 1].at - blocks[i].at;
+        }
+    }
+    size = (size + S_ARENA_ALIGN - 1) & ~(size_t) (S_ARENA_ALIGN - 1);
+    frag = malloc(sizeof *frag + size + (num_blocks > 0 ? sizeof *blocks * (num_blocks + 1) : 0));
+    if (frag == NULL) {
+        return;
+    }
+    frag->num_blocks = num_blocks;
+    frag->num_stale = 0;
+    frag->last = 0;
+    frag->array = array;
+    frag->blocks = NULL;
+    if (num_blocks == 0) {
+        memcpy(frag->data, &ctx->data[start], len);
+        frag->len = len;
+    } else {
+        frag->blocks = (S_fragment_block_t *) &frag->data[size];
+        memcpy(frag->data, &ctx->data[start], blocks[0].at);
+        at = blocks[0].at;
+        for (i = 0; i <= num_blocks; i++) {
+            frag->blocks[i] = blocks[i];
+            frag->blocks[i].at = at;
+            if (i < num_blocks && !blocks[i].live) {
+                memcpy(&frag->data[at], &ctx->data[start + blocks[i].at], blocks[i + 1].at - blocks[i].at);
+                at += blocks[i + 1].at - blocks[i].at;
+            }
+        }
+        memcpy(&frag->data[at], &ctx->data[start + blocks[num_blocks].at], len - blocks[num_blocks].at);
+        frag->len = at + len - blocks[num_blocks].at;
+    }
+    expected = NULL;
+    if (!S_ATOMIC_CAS(&node->cache, &expected, frag)) {
+        free(frag); // Written concurrently by another thread
+    }
+}
+
+/*
+ * Writes an array or an object from its cache, or serializes
+ * it and keeps the result. Containers which cannot be cached
+ * are written in one go, without blocks.
+ */
+static int S_write_container(S_write_ctx_t *ctx, S_container_t *node, int array, size_t count) {
+    const char *brackets;
+    size_t     start;
+    size_t     base;
+    int        res;
+
+    if ((res = S_cache_write(ctx, node)) != -1) {
+        return res;
+    }
+    brackets = array ? "[]" : "{}";
+    start = ctx->len;
+    if (S_write_add_bytes(ctx, brackets, 1) == 0) {
+        return 0;
+    }
+    if (ctx->split == &node->body) {
+        ctx->split = NULL;
+        ctx->split_at = ctx->len;
+        return S_write_add_bytes(ctx, brackets + 1, 1);
+    }
+    if (ctx->canonical || S_body_is_pooled(&node->body)) {
+        return S_write_slots(ctx, node, array, 0, count) && S_write_add_bytes(ctx, brackets + 1, 1);
+    }
+    base = ctx->num_blocks;
+    res = S_cache_write_blocks(ctx, node, array, count, start) && S_write_add_bytes(ctx, brackets + 1, 1);
+    if (res) {
+        S_cache_store(ctx, node, array, start, base);
+    }
+    ctx->num_blocks = base;
+    return res;
+}
+
+/*
+ * Marks a slot of the container stale in its fragment, or
+ * drops the fragment when it is written whole, when all slots
+ * are concerned, or when too many blocks went stale.
+ */
+static void S_cache_stale(S_container_t *node, size_t slot) {
+    S_fragment_t *frag;
+    size_t       lo;
+    size_t       hi;
+    size_t       mid;
+
+    frag = node->cache;
+    if (frag == NULL) {
+        return;
+    }
+    if (frag->num_blocks == 0 || slot == S_WRITE_CACHE_SLOT_ALL) {
+        S_cache_clear(&node->cache);
+        return;
+    }
+    lo = 0;
+    hi = frag->num_blocks;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (frag->blocks[mid].slot <= slot) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    frag->last = slot;
+    if (frag->blocks[lo].live) {
+        return;
+    }
+    frag->blocks[lo].live = 1;
+    if (++frag->num_stale * S_WRITE_CACHE_STALE_RATIO > frag->num_blocks) {
+        S_cache_clear(&node->cache);
+    }
+}
+
+/*
+ * Finds the slot of a child in the fragment of its parent,
+ * trying the slot made stale last first, as edits walk down
+ * the document before they walk back up.
+ */
+static size_t S_container_find(S_container_t *node, S_container_t *child) {
+    S_fragment_t *frag;
+    size_t       count;
+    size_t       i;
+
+    frag = node->cache;
+    if (frag == NULL || frag->num_blocks == 0) {
+        return S_WRITE_CACHE_SLOT_ALL; // Nothing to look for
+    }
+    count = frag->blocks[frag->num_blocks].slot;
+    if (frag->last < count && S_container_slot(node, frag->array, frag->last) == child) {
+        return frag->last;
+    }
+    for (i = 0; i < count; i++) {
+        if (S_container_slot(node, frag->array, i) == child) {
+            return i;
+        }
+    }
+    return S_WRITE_CACHE_SLOT_ALL;
+}
+
+/*
+ * Makes a slot of a checked container stale, or all of them
+ * with S_WRITE_CACHE_SLOT_ALL, along with the slots holding
+ * the container in each of its ancestors.
+ */
+static void S_container_dirty(S_container_t *node, size_t slot) {
+    S_container_t *child;
+
+    for (;;) {
+        S_cache_stale(node, slot);
+        child = node;
+        node = node->up.parent;
+        if (node == NULL) {
+            return;
+        }
+        slot = S_container_find(node, child);
+    }
+}
+
+/* ----------------------------------------------------- */
+
+static int S_parse_value(S_ctx *ctx, S_value_t *value) {
+    if (ctx->ptr == ctx->end) {
+        return 0;
+    } else if (*ctx->ptr == '"') {
+        return S_parse_string(ctx, value);
+    } else if (*ctx->ptr == '{') {
+        return S_parse_object(ctx, value);
+    } else if (*ctx->ptr == '[') {
+        return S_parse_array(ctx, value);
+    } else if (S_number_check_if_possible(*ctx->ptr)) {
+        return S_parse_number(ctx, value);
+    } else if (*ctx->ptr == 't' || *ctx->ptr == 'f') {
+        return S_parse_boolean(ctx, value);
+    } else if (*ctx->ptr == 'n') {
+        return S_parse_null(ctx, value);
+    } else {
+        return 0;
+    }
+}
+
+static S_array_t *S_array_copy(S_array_t *arr) {
+    S_array_t *copy;
+    S_value_t *values;
+    size_t    i;
+
+    copy = S_array_create(NULL);
+    if (copy == NULL || arr->num_values == 0) {
+        return copy;
+    }
+    if (S_array_numbers(arr) != NULL) {
+        copy->numbers = malloc(sizeof *copy->numbers * arr->num_values);
+        if (copy->numbers == NULL) {
+            S_array_destroy(&copy);
+            return NULL;
+        }
+        memcpy(copy->numbers, S_array_numbers(arr), sizeof *copy->numbers * arr->num_values);
+    } else {
+        copy->values = malloc(sizeof *copy->values * arr->num_values);
+        if (copy->values == NULL) {
+            S_array_destroy(&copy);
+            return NULL;
+        }
+        values = S_array_values(arr);
+        for (i = 0; i < arr->num_values; i++) {
+            S_value_copy_slot(&copy->values[i], &values[i]);
+            S_value_retain(&copy->values[i]);
+        }
+    }
+    copy->num_values = arr->num_values;
+    copy->size = arr->num_values;
+    return copy;
+}
+
+static S_object_t S_object_copy(S_object_t obj) {
+    S_object_t copy;
+    size_t     i;
+
+    copy = S_object_create(NULL);
+    if (copy == NULL || obj->num_entries == 0) {
+        return copy;
+    }
+    copy->entries = malloc(sizeof *copy->entries * obj->num_entries);
+    if (copy->entries == NULL) {
+        S_object_destroy(&copy);
+        return NULL;
+    }
+    for (i = 0; i < obj->num_entries; i++) {
+        copy->entries[i].name = obj->entries[i].name;
+        S_value_copy_slot(&copy->entries[i].value, &obj->entries[i].value);
+        S_value_retain(&copy->entries[i].name);
+        S_value_retain(&copy->entries[i].value);
+    }
+    copy->num_entries = obj->num_entries;
+    copy->size = obj->num_entries;
+    return copy;
+}
+
+/*
+ * Make sure a container is only referenced from the given
+ * handle, replacing it with a shallow copy if it is shared.
+ * The owner is the container holding the handle, NULL for a
+ * root. The children of the copy become shared in turn, so they
+ * get copied when they are themselves modified. Parser owned
+ * containers cannot be modified.
+ */
+static S_error_code_t S_object_unshare(S_object_t *obj, S_container_t *owner) {
+    S_value_t  old;
+    S_object_t copy;
+
+    if (S_ATOMIC_LOAD(&(*obj)->base.body.refs) == 1) {
+        return S_ERROR_CODE_OK;
+    }
+    if (S_body_is_pooled(&(*obj)->base.body)) {
+        return S_ERROR_CODE_READ_ONLY;
+    }
+    copy = S_object_copy(*obj);
+    if (copy == NULL) {
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    copy->base.up.parent = owner;
+    if (owner == NULL) {
+        copy->base.body.flags |= S_BODY_FLAG_ROOT;
+    }
+    S_value_set_object(&old, *obj);
+    S_value_release(&old, owner);
+    *obj = copy;
+    return S_ERROR_CODE_OK;
+}
+
+static S_error_code_t S_array_unshare(S_array_t **arr, S_container_t *owner) {
+    S_value_t old;
+    S_array_t *copy;
+
+    if (S_ATOMIC_LOAD(&(*arr)->base.body.refs) == 1) {
+        return S_ERROR_CODE_OK;
+    }
+    if (S_body_is_pooled(&(*arr)->base.body)) {
+        return S_ERROR_CODE_READ_ONLY;
+    }
+    copy = S_array_copy(*arr);
+    if (copy == NULL) {
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    copy->base.up.parent = owner;
+    S_value_set_array(&old, *arr);
+    S_value_release(&old, owner);
+    *arr = copy;
+    return S_ERROR_CODE_OK;
+}
+
+/*
+ * Copies a parser (or image) owned value and its children to
+ * the heap.
+ */
+static int S_value_copy_deep(S_value_t *copy, S_value_t *value) {
+    const char       *data;
+    char             buf[S_LEXEME_INLINE_MAX + 1];
+    size_t           len;
+    S_string_t       *str;
+    S_array_t        *arr;
+    S_array_t        *src_arr;
+    S_value_t        *src_values;
+    S_object_t       obj;
+    S_object_t       src_obj;
+    S_object_entry_t *src_entries;
+    size_t           i;
+
+    switch (value->type) {
+        case S_VALUE_TYPE_STRING:
+            if (value->bits & S_VALUE_BITS_INLINE) {
+                *copy = *value;
+                return 1;
+            }
+            str = (S_string_t *) S_value_body(value);
+            if (S_value_set_string(NULL, copy, str->data, str->len) == 0) {
+                return 0;
+            }
+            copy->bits = value->bits & S_VALUE_BITS_LAST;
+            return 1;
+        case S_VALUE_TYPE_NUMBER:
+            if (!S_value_has_body(value)) {
+                S_value_copy_slot(copy, value);
+                return 1;
+            }
+            data = S_value_lexeme(value, buf, &len);
+            return S_value_set_lexeme(NULL, copy, data, len);
+        case S_VALUE_TYPE_ARRAY:
+            src_arr = S_value_array(value);
+            if (S_array_numbers(src_arr) != NULL) {
+                arr = S_array_copy(src_arr);
+                if (arr == NULL) {
+                    return 0;
+                }
+                S_value_set_array(copy, arr);
+                return 1;
+            }
+            arr = S_array_create(NULL);
+            if (arr == NULL) {
+                return 0;
+            }
+            S_value_set_array(copy, arr);
+            if (src_arr->num_values == 0) {
+                return 1;
+            }
+            arr->values = malloc(sizeof *arr->values * src_arr->num_values);
+            if (arr->values == NULL) {
+                S_value_destroy(copy);
+                return 0;
+            }
+            src_values = S_array_values(src_arr);
+            for (i = 0; i < src_arr->num_values; i++) {
+                if (S_value_copy_deep(&arr->values[i], &src_values[i]) == 0) {
+                    S_value_destroy(copy);
+                    return 0;
+                }
+                S_container_adopt(&arr->base, &arr->values[i]);
+                arr->num_values = arr->size = i + 1;
+            }
+            return 1;
+        case S_VALUE_TYPE_OBJECT:
+            src_obj = S_value_object(value);
+            obj = S_object_create(NULL);
+            if (obj == NULL) {
+                return 0;
+            }
+            S_value_set_object(copy, obj);
+            if (src_obj->num_entries == 0) {
+                return 1;
+            }
+            obj->entries = malloc(sizeof *obj->entries * src_obj->num_entries);
+            if (obj->entries == NULL) {
+                S_value_destroy(copy);
+                return 0;
+            }
+            src_entries = S_object_entries(src_obj);
+            for (i = 0; i < src_obj->num_entries; i++) {
+                if (S_value_copy_deep(&obj->entries[i].name, &src_entries[i].name) == 0) {
+                    S_value_destroy(copy);
+                    return 0;
+                }
+                if (S_value_copy_deep(&obj->entries[i].value, &src_entries[i].value) == 0) {
+                    S_value_destroy(&obj->entries[i].name);
+                    S_value_destroy(copy);
+                    return 0;
+                }
+                S_container_adopt(&obj->base, &obj->entries[i].value);
+                obj->num_entries = obj->size = i + 1;
+            }
+            return 1;
+        default:
+            *copy = *value;
+            return 1;
+    }
+}
+
+/*
+ * Drops the reference the slot holds to its body, freeing the
+ * body with the last one. The slot is left null.
+ */
+static void S_value_destroy(S_value_t *value) {
+    if (S_value_has_body(value) && !S_body_is_pooled(S_value_body(value))
+            && S_ATOMIC_DEC(&value->as.body->refs) == 0) {
+        switch (value->type) {
+            case S_VALUE_TYPE_STRING:
+            case S_VALUE_TYPE_NUMBER:
+                free(value->as.body);
+                break;
+            case S_VALUE_TYPE_OBJECT:
+                S_object_destroy(&value->as.object);
+                break;
+            case S_VALUE_TYPE_ARRAY:
+                S_array_destroy(&value->as.array);
+                break;
+            default:
+                break;
+        }
+    }
+    S_value_set_null(value);
+}
+
+static S_object_t S_parse_root(S_ctx *ctx) {
+    S_value_t value;
+
+    S_skip_whitespace(ctx);
+    if (ctx->ptr == ctx->end || *ctx->ptr != '{') {
+        return NULL;
+    }
+    if (S_parse_object(ctx, &value) == 0) {
+        return NULL;
+    }
+    if (ctx->parser == NULL) {
+        value.as.object->base.body.flags |= S_BODY_FLAG_ROOT;
+    }
+    return value.as.object;
+}
+
+S_object_t S_parse(const char *data, size_t sz) {
+    return S_parse_ex(data, sz, S_PARSE_FLAG_NONE);
+}
+
+S_object_t S_parse_ex(const char *data, size_t sz, unsigned int flags) {
+    S_ctx      ctx;
+    S_object_t obj;
+
+    S_ctx_init(&ctx, data, sz, flags);
+    obj = S_parse_root(&ctx);
+    free(ctx.stack);
+    free(ctx.nums);
+    return obj;
+}
+
+S_object_t S_parse_projected(const char *data, size_t sz, const char *const *fields) {
+    static S_projection_t none = {"", (size_t) -1, NULL, NULL}; // Matches no key
+    S_ctx          ctx;
+    S_object_t     obj;
+    S_projection_t *projection;
+    size_t         i;
+
+    projection = NULL;
+    for (i = 0; fields != NULL && fields[i] != NULL; i++) {
+        if (S_projection_add(&projection, fields[i]) == 0) {
+            S_projection_destroy(&projection);
+            return NULL;
+        }
+    }
+    S_ctx_init(&ctx, data, sz, S_PARSE_FLAG_NONE);
+    ctx.projection = projection != NULL ? projection : &none;
+    obj = S_parse_root(&ctx);
+    free(ctx.stack);
+    free(ctx.nums);
+    S_projection_destroy(&projection);
+    return obj;
+}
+
+S_parser_t *S_parser_create(unsigned int flags) {
+    S_parser_t *parser;
+
+    parser = malloc(sizeof *parser);
+    if (parser == NULL) {
+        return NULL;
+    }
+    parser->head = S_arena_block_create(S_ARENA_BLOCK_SIZE);
+    if (parser->head == NULL) {
+        free(parser);
+        return NULL;
+    }
+    parser->curr = parser->head;
+    parser->stack = NULL;
+    parser->stack_size = 0;
+    parser->nums = NULL;
+    parser->nums_size = 0;
+    parser->flags = flags;
+    parser->extra = NULL;
+    return parser;
+}
+
+S_object_t S_parse_with(S_parser_t *parser, const char *data, size_t sz) {
+    S_ctx      ctx;
+    S_object_t obj;
+
+    S_arena_reset(parser);
+    S_ctx_init(&ctx, data, sz, parser->flags);
+    ctx.parser = parser;
+    ctx.stack = parser->stack;
+    ctx.stack_size = parser->stack_size;
+    ctx.nums = parser->nums;
+    ctx.nums_size = parser->nums_size;
+    obj = S_parse_root(&ctx);
+    parser->stack = ctx.stack;
+    parser->stack_size = ctx.stack_size;
+    parser->nums = ctx.nums;
+    parser->nums_size = ctx.nums_size;
+    return obj;
+}
+
+void S_parser_destroy(S_parser_t **parser) {
+    S_arena_blocks_destroy((*parser)->head);
+    S_arena_blocks_destroy((*parser)->extra);
+    free((*parser)->stack);
+    free((*parser)->nums);
+    free(*parser);
+    *parser = NULL;
+}
+
+void S_destroy(S_object_t *obj) {
+    S_value_t value;
+
+    S_value_set_object(&value, *obj);
+    S_value_destroy(&value);
+    *obj = NULL;
+}
+
+S_object_t S_clone(S_object_t obj) {
+    S_value_t value;
+    S_value_t copy;
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    S_value_set_object(&value, obj);
+    if (S_body_is_pooled(&obj->base.body)) {
+        if (S_value_copy_deep(&copy, &value) == 0) {
+            return NULL;
+        }
+        copy.as.object->base.body.flags |= S_BODY_FLAG_ROOT;
+        return copy.as.object;
+    }
+    S_value_retain(&value);
+    return obj;
+}
+
+static int S_write_value(S_write_ctx_t *ctx, S_value_t *val) {
+    switch (val->type) {
+        case S_VALUE_TYPE_OBJECT:
+            return S_write_object(ctx, S_value_object(val));
+            break;
+        case S_VALUE_TYPE_ARRAY:
+            return S_write_array(ctx, S_value_array(val));
+            break;
+        case S_VALUE_TYPE_STRING:
+            return S_write_string(ctx, val);
+            break;
+        case S_VALUE_TYPE_NUMBER:
+            return S_write_number(ctx, val);
+            break;
+        case S_VALUE_TYPE_BOOLEAN:
+            return S_write_boolean(ctx, val);
+            break;
+        case S_VALUE_TYPE_NULL:
+            return S_write_null(ctx);
+            break;
+        default:
+            return 0;
+    }
+}
+
+char *S_write(S_object_t obj) {
+    S_write_ctx_t ctx;
+    char          *out;
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    ctx = S_write_ctx_create();
+    if (ctx.data == NULL) {
+        return NULL;
+    }
+    if (S_write_object(&ctx, obj) == 0) {
+        S_write_ctx_destroy(&ctx);
+        return NULL;
+    }
+    out = ctx.data;
+    out[ctx.len] = '\0';
+    ctx.data = NULL;
+    S_write_ctx_destroy(&ctx);
+    return out;
+}
+
+char *S_write_canonical(S_object_t obj) {
+    S_write_ctx_t ctx;
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    ctx = S_write_ctx_create();
+    if (ctx.data == NULL) {
+        return NULL;
+    }
+    ctx.canonical = 1;
+    if (S_write_object(&ctx, obj) == 0) {
+        S_write_ctx_destroy(&ctx);
+        return NULL;
+    }
+    ctx.data[ctx.len] = '\0';
+    return ctx.data;
+}
+
+/*
+ * A range of elements of the split container, serialized on
+ * its own buffer.
+ */
+typedef struct {
+    S_write_ctx_t ctx;
+    S_value_t     *target;
+    size_t        begin;
+    size_t        end;
+    int           res;
+} S_write_chunk_t;
+
+static size_t S_container_size(S_value_t *value) {
+    if (value->type == S_VALUE_TYPE_OBJECT) {
+        return S_value_object(value)->num_entries;
+    }
+    return S_value_array(value)->num_values;
+}
+
+/*
+ * Looks for the container to split, from the root down to the
+ * biggest child while containers are small. Fails on a cached
+ * container, which is written by a single copy anyway.
+ */
+static int S_write_split_find(S_value_t *root, S_value_t *target) {
+    S_value_t    *cur;
+    S_value_t    *child;
+    S_value_t    *best;
+    S_fragment_t **cache;
+    size_t       count;
+    size_t       i;
+
+    cur = root;
+    for (;;) {
+        if (cur->type == S_VALUE_TYPE_OBJECT) {
+            cache = &S_value_object(cur)->base.cache;
+        } else {
+            cache = &S_value_array(cur)->base.cache;
+        }
+        if (S_ATOMIC_LOAD(cache) != NULL) {
+            return 0;
+        }
+        count = S_container_size(cur);
+        if (count >= S_WRITE_PARALLEL_MIN_SIZE) {
+            if (cur->type == S_VALUE_TYPE_OBJECT) {
+                S_value_set_object(target, S_value_object(cur));
+            } else {
+                S_value_set_array(target, S_value_array(cur));
+            }
+            return 1;
+        }
+        best = NULL;
+        for (i = 0; i < count; i++) {
+            if (cur->type == S_VALUE_TYPE_OBJECT) {
+                child = &S_object_entries(S_value_object(cur))[i].value;
+            } else if (S_array_numbers(S_value_array(cur)) == NULL) {
+                child = &S_array_values(S_value_array(cur))[i];
+            } else {
+                break; // Packed numbers
+            }
+            if ((child->type == S_VALUE_TYPE_OBJECT || child->type == S_VALUE_TYPE_ARRAY)
+                    && (best == NULL || S_container_size(child) > S_container_size(best))) {
+                best = child;
+            }
+        }
+        if (best == NULL) {
+            return 0;
+        }
+        cur = best;
+    }
+}
+
+static void *S_write_chunk_run(void *arg) {
+    S_write_chunk_t *chunk;
+    S_value_t       *target;
+
+    chunk = arg;
+    target = chunk->target;
+    if (chunk->ctx.data == NULL) {
+        chunk->res = 0;
+    } else if (target->type == S_VALUE_TYPE_OBJECT) {
+        chunk->res = S_write_object_entries(&chunk->ctx, target->as.object, chunk->begin, chunk->end);
+    } else {
+        chunk->res = S_write_array_values(&chunk->ctx, target->as.array, chunk->begin, chunk->end);
+    }
+    return NULL;
+}
+
+char *S_write_parallel(S_object_t obj, unsigned int nthreads) {
+    S_value_t       root;
+    S_value_t       target;
+    S_write_ctx_t   ctx;
+    S_write_chunk_t *chunks;
+    char            *out;
+    size_t          count;
+    size_t          len;
+    size_t          i;
+    int             res;
+#if defined(S_HAVE_PTHREAD)
+    pthread_t       *threads;
+    unsigned char   *started;
+#endif
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    S_value_set_object(&root, obj);
+    if (nthreads < 2 || S_write_split_find(&root, &target) == 0) {
+        return S_write(obj);
+    }
+    count = S_container_size(&target);
+    if (nthreads > count) {
+        nthreads = (unsigned int) count;
+    }
+    chunks = calloc(nthreads, sizeof *chunks);
+    if (chunks == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nthreads; i++) {
+        chunks[i].ctx = S_write_ctx_create();
+        chunks[i].target = &target;
+        chunks[i].begin = i * (count / nthreads) + (i < count % nthreads ? i : count % nthreads);
+        chunks[i].end = chunks[i].begin + count / nthreads + (i < count % nthreads);
+    }
+
+#if defined(S_HAVE_PTHREAD)
+    threads = malloc(nthreads * sizeof *threads);
+    started = calloc(nthreads, 1);
+    for (i = 1; threads != NULL && started != NULL && i < nthreads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, S_write_chunk_run, &chunks[i]) == 0;
+    }
+#endif
+
+    // Everything around the split container, then the first range
+    ctx = S_write_ctx_create();
+    ctx.split = target.as.body;
+    res = ctx.data != NULL && S_write_object(&ctx, obj);
+    S_write_chunk_run(&chunks[0]);
+
+    for (i = 1; i < nthreads; i++) {
+#if defined(S_HAVE_PTHREAD)
+        if (threads != NULL && started != NULL && started[i]) {
+            pthread_join(threads[i], NULL);
+            continue;
+        }
+#endif
+        S_write_chunk_run(&chunks[i]);
+    }
+#if defined(S_HAVE_PTHREAD)
+    free(threads);
+    free(started);
+#endif
+
+    out = NULL;
+    if (res && ctx.split_at == 0) {
+        out = ctx.data; // The container got cached meanwhile, nothing to fill
+        out[ctx.len] = '\0';
+        ctx.data = NULL;
+    } else if (res) {
+        len = ctx.len;
+        for (i = 0; i < nthreads; i++) {
+            res = res && chunks[i].res;
+            len += chunks[i].ctx.len;
+        }
+        out = res ? malloc(len + 1) : NULL;
+    }
+    if (out != NULL && ctx.split_at != 0) {
+        memcpy(out, ctx.data, ctx.split_at);
+        len = ctx.split_at;
+        for (i = 0; i < nthreads; i++) {
+            memcpy(&out[len], chunks[i].ctx.data, chunks[i].ctx.len);
+            len += chunks[i].ctx.len;
+        }
+        memcpy(&out[len], &ctx.data[ctx.split_at], ctx.len - ctx.split_at);
+        out[len + ctx.len - ctx.split_at] = '\0';
+    }
+
+    S_write_ctx_destroy(&ctx);
+    for (i = 0; i < nthreads; i++) {
+        S_write_ctx_destroy(&chunks[i].ctx);
+    }
+    free(chunks);
+    return out;
+}
+
+uint64_t S_hash(S_object_t obj) {
+    S_write_ctx_t ctx;
+    S_hash_t      hash;
+
+    if (obj == NULL) {
+        return 0;
+    }
+    ctx.data = NULL;
+    ctx.len = 0;
+    ctx.size = 0;
+    ctx.canonical = 1;
+    ctx.hash = &hash;
+    ctx.split = NULL;
+    ctx.split_at = 0;
+    ctx.blocks = NULL;
+    ctx.num_blocks = 0;
+    ctx.blocks_size = 0;
+    S_hash_init(&hash);
+    if (S_write_object(&ctx, obj) == 0) {
+        return 0;
+    }
+    return S_hash_digest(&hash);
+}
+
+static int S_validate_string(S_ctx *ctx) {
+    char *start;
+
+    start = ctx->ptr + 1;
+    if (S_scan_string(ctx) == 0) {
+        return 0;
+    }
+    if ((ctx->flags & S_PARSE_FLAG_VALIDATE_UTF8)
+            && S_utf8_validate(start, ctx->ptr - start) == 0) {
+        ctx->ptr = start;
+        return 0;
+    }
+    ctx->ptr++;
+    return 1;
+}
+
+/*
+ * Walks the document with the parser's grammar, keeping the
+ * closing bracket of every open container on a fixed stack
+ * instead of recursing.
+ */
+S_bool_t S_validate(const char *data, size_t sz, size_t *err_offset) {
+    S_ctx  ctx;
+    char   stack[S_VALIDATE_MAX_DEPTH];
+    size_t depth;
+
+    S_ctx_init(&ctx, data, sz, S_PARSE_FLAG_VALIDATE_UTF8);
+    S_skip_whitespace(&ctx);
+    if (ctx.ptr == ctx.end || *ctx.ptr != '{') {
+        goto error;
+    }
+    depth = 0;
+value:
+    switch (*ctx.ptr) {
+        case '{':
+        case '[':
+            if (depth == S_VALIDATE_MAX_DEPTH) {
+                goto error;
+            }
+            stack[depth++] = *ctx.ptr == '{' ? '}' : ']';
+            ctx.ptr++;
+            S_skip_whitespace(&ctx);
+            if (ctx.ptr == ctx.end) {
+                goto error;
+            }
+            if (*ctx.ptr == stack[depth - 1]) {
+                goto close;
+            }
+            if (stack[depth - 1] == '}') {
+                goto key;
+            }
+            goto value;
+        case '"':
+            if (S_validate_string(&ctx) == 0) {
+                goto error;
+            }
+            break;
+        case 't':
+        case 'f':
+            if (S_scan_literal(&ctx, "true", 4) == 0 && S_scan_literal(&ctx, "false", 5) == 0) {
+                goto error;
+            }
+            break;
+        case 'n':
+            if (S_scan_literal(&ctx, "null", 4) == 0) {
+                goto error;
+            }
+            break;
+        default:
+            if (S_scan_number(&ctx) == 0) {
+                goto error;
+            }
+            break;
+    }
+next:
+    if (depth == 0) {
+        S_skip_whitespace(&ctx);
+        if (ctx.ptr != ctx.end) {
+            goto error;
+        }
+        return 1;
+    }
+    S_skip_whitespace(&ctx);
+    if (ctx.ptr == ctx.end) {
+        goto error;
+    }
+    if (*ctx.ptr == ',') {
+        ctx.ptr++;
+        S_skip_whitespace(&ctx);
+        if (ctx.ptr == ctx.end) {
+            goto error;
+        }
+        if (*ctx.ptr == stack[depth - 1]) {
+            goto close; // Trailing comma, as accepted by the parser
+        }
+        if (stack[depth - 1] == ']') {
+            goto value;
+        }
+        goto key;
+    }
+    if (*ctx.ptr != stack[depth - 1]) {
+        goto error;
+    }
+close:
+    ctx.ptr++;
+    depth--;
+    goto next;
+key:
+    if (*ctx.ptr != '"' || S_validate_string(&ctx) == 0) {
+        goto error;
+    }
+    S_skip_whitespace(&ctx);
+    if (ctx.ptr == ctx.end || *ctx.ptr != ':') {
+        goto error;
+    }
+    ctx.ptr++;
+    S_skip_whitespace(&ctx);
+    if (ctx.ptr == ctx.end) {
+        goto error;
+    }
+    goto value;
+error:
+    if (err_offset != NULL) {
+        *err_offset = ctx.ptr - data;
+    }
+    return 0;
+}
+
+S_value_t *S_object_get(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_object_entry_t *entries;
+    size_t           len;
+    size_t           i;
+
+    len = strlen(name);
+    entries = obj == NULL ? NULL : S_object_entries(obj);
+    for (i = 0; obj != NULL && i < obj->num_entries; i++) {
+        if (S_object_entry_name_equals(&entries[i], name, len)) {
+            if (err) {
+                *err = S_ERROR_CODE_OK;
+            }
+            return &entries[i].value;
+        }
+    }
+    if (err) {
+        *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+    }
+    return NULL;
+}
+
+/*
+ * Returns a heap copy of the string in a slot.
+ */
+static char *S_value_string_copy(S_value_t *value, S_error_code_t *err) {
+    const char *data;
+    size_t     len;
+    char       *s;
+
+    data = S_value_string(value, &len);
+    s = malloc(len + 1);
+    if (s == NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_MALLOC_ERR;
+        }
+        return NULL;
+    }
+    memcpy(s, data, len + 1);
+    return s;
+}
+
+S_bool_t S_object_get_bool(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_BOOLEAN, 0)
+    return value->as.boolean;
+}
+
+double S_object_get_number(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_NUMBER, 0.0)
+    return S_value_number(value);
+}
+
+S_object_t S_object_get_object(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_OBJECT, NULL);
+    return S_value_object(value);
+}
+
+char *S_object_get_string(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_STRING, NULL);
+    return S_value_string_copy(value, err);
+}
+
+S_array_t *S_object_get_array(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_ARRAY, NULL);
+    return S_value_array(value);
+}
+
+S_bool_t S_object_is_null(S_object_t obj, const char *name, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_object_get(obj, name, err);
+    if (value == NULL) {
+        return 0;
+    }
+    return value->type == S_VALUE_TYPE_NULL;
+}
+
+S_value_t *S_array_get(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *values;
+
+    if (arr == NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+        }
+        return NULL;
+    }
+    if (i >= arr->num_values) {
+        if (err) {
+            *err = S_ERROR_CODE_OUT_OF_BOUNDS;
+        }
+        return NULL;
+    }
+    values = S_array_slots(arr);
+    if (values == NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_MALLOC_ERR;
+        }
+        return NULL;
+    }
+    if (err) {
+        *err = S_ERROR_CODE_OK;
+    }
+    return &values[i];
+}
+
+S_bool_t S_array_get_bool(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_array_get(arr, i, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_BOOLEAN, 0);
+    return value->as.boolean;
+}
+
+double S_array_get_number(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    if (arr != NULL && S_array_numbers(arr) != NULL && i < arr->num_values) {
+        if (err) {
+            *err = S_ERROR_CODE_OK;
+        }
+        return S_array_numbers(arr)[i];
+    }
+    value = S_array_get(arr, i, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_NUMBER, 0.0);
+    return S_value_number(value);
+}
+
+S_object_t S_array_get_object(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_array_get(arr, i, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_OBJECT, NULL);
+    return S_value_object(value);
+}
+
+char *S_array_get_string(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_array_get(arr, i, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_STRING, NULL);
+    return S_value_string_copy(value, err);
+}
+
+S_array_t *S_array_get_array(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    value = S_array_get(arr, i, err);
+    S_CHECK_VALUE(S_VALUE_TYPE_ARRAY, NULL);
+    return S_value_array(value);
+}
+
+S_bool_t S_array_is_null(S_array_t *arr, size_t i, S_error_code_t *err) {
+    S_value_t *value;
+
+    if (arr != NULL && S_array_numbers(arr) != NULL && i < arr->num_values) {
+        if (err) {
+            *err = S_ERROR_CODE_OK;
+        }
+        return 0;
+    }
+    value = S_array_get(arr, i, err);
+    if (value == NULL) {
+        return 0;
+    }
+    return value->type == S_VALUE_TYPE_NULL;
+}
+
+S_error_code_t S_array_get_numbers(S_array_t *arr, const double **numbers, size_t *n) {
+    if (arr == NULL) {
+        return S_ERROR_CODE_OBJECT_NOT_FOUND;
+    }
+    if (S_array_numbers(arr) == NULL && arr->num_values > 0) {
+        return S_ERROR_CODE_INVALID_TYPE;
+    }
+    *numbers = S_array_numbers(arr);
+    *n = arr->num_values;
+    return S_ERROR_CODE_OK;
+}
+
+size_t S_array_size(S_array_t *arr) {
+    return arr == NULL ? 0 : arr->num_values;
+}
+
+S_object_entry_t *S_object_first(S_object_t obj) {
+    return obj == NULL || obj->num_entries == 0 ? NULL : S_object_entries(obj);
+}
+
+S_object_entry_t *S_object_entry_next(S_object_entry_t *entry) {
+    return entry->name.bits & S_VALUE_BITS_LAST ? NULL : entry + 1;
+}
+
+const char *S_object_entry_name(S_object_entry_t *entry, size_t *len) {
+    const char *name;
+    size_t     name_len;
+
+    name = S_value_string(&entry->name, &name_len);
+    if (len) {
+        *len = name_len;
+    }
+    return name;
+}
+
+S_value_t *S_object_entry_value(S_object_entry_t *entry) {
+    return &entry->value;
+}
+
+S_value_type_t S_value_get_type(S_value_t *value) {
+    return value->type;
+}
+
+S_bool_t S_value_get_bool(S_value_t *value, S_error_code_t *err) {
+    S_CHECK_VALUE_FOUND(0)
+    S_CHECK_VALUE(S_VALUE_TYPE_BOOLEAN, 0)
+    return value->as.boolean;
+}
+
+double S_value_get_number(S_value_t *value, S_error_code_t *err) {
+    S_CHECK_VALUE_FOUND(0)
+    S_CHECK_VALUE(S_VALUE_TYPE_NUMBER, 0)
+    return S_value_number(value);
+}
+
+S_object_t S_value_get_object(S_value_t *value, S_error_code_t *err) {
+    S_CHECK_VALUE_FOUND(NULL)
+    S_CHECK_VALUE(S_VALUE_TYPE_OBJECT, NULL)
+    return S_value_object(value);
+}
+
+S_array_t *S_value_get_array(S_value_t *value, S_error_code_t *err) {
+    S_CHECK_VALUE_FOUND(NULL)
+    S_CHECK_VALUE(S_VALUE_TYPE_ARRAY, NULL)
+    return S_value_array(value);
+}
+
+const char *S_value_get_string_ref(S_value_t *value, size_t *len, S_error_code_t *err) {
+    const char *data;
+    size_t     data_len;
 
-    n = 1;
-    if (num->value != 0.0) {
-        n = (int) log10(abs((int) num->value)) + 1;
+    S_CHECK_VALUE_FOUND(NULL)
+    S_CHECK_VALUE(S_VALUE_TYPE_STRING, NULL)
+    data = S_value_string(value, &data_len);
+    if (len) {
+        *len = data_len;
     }
-    s = calloc(1, n + 1 + S_WRITE_NUMBER_NUM_DECIMAL_POINT + 1);
-    if (s == NULL) {
-        return 0;
+    return data;
+}
+
+/*
+ * Takes over the value in the slot, which is released on
+ * failure.
+ */
+static S_error_code_t S_object_set_value(S_object_t *obj, const char *name, S_value_t *value) {
+    S_object_entry_t *temp;
+    S_object_entry_t *entry;
+    S_error_code_t   res;
+    size_t           len;
+    size_t           i;
+
+    if (obj == NULL || *obj == NULL) {
+        S_value_destroy(value);
+        return S_ERROR_CODE_OBJECT_NOT_FOUND;
+    }
+    if ((res = S_container_check(&(*obj)->base)) != S_ERROR_CODE_OK
+            || (res = S_object_unshare(obj, NULL)) != S_ERROR_CODE_OK) {
+        S_value_destroy(value);
+        return res;
     }
-    sprintf(s, S_WRITE_NUMBER_FORMAT, num->value);
-    if (S_write_add_string(ctx, s) == 0) {
+    len = strlen(name);
+    for (i = 0; i < (*obj)->num_entries; i++) {
+        if (S_object_entry_name_equals(&(*obj)->entries[i], name, len)) {
+            S_value_release(&(*obj)->entries[i].value, &(*obj)->base);
+            (*obj)->entries[i].value = *value;
+            S_container_dirty(&(*obj)->base, i);
+            return S_ERROR_CODE_OK;
+        }
+    }
+    if ((*obj)->num_entries == (*obj)->size) {
+        temp = realloc((*obj)->entries, sizeof *temp * ((*obj)->size == 0 ? 4 : 2 * (*obj)->size));
+        if (temp == NULL) {
+            S_value_destroy(value);
+            return S_ERROR_CODE_MALLOC_ERR;
+        }
+        (*obj)->entries = temp;
+        (*obj)->size = (*obj)->size == 0 ? 4 : 2 * (*obj)->size;
+    }
+    entry = &(*obj)->entries[(*obj)->num_entries];
+    if (S_value_set_string(NULL, &entry->name, name, len) == 0) {
+        S_value_destroy(value);
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    entry->name.bits |= S_VALUE_BITS_LAST;
+    entry->value = *value;
+    if ((*obj)->num_entries > 0) {
+        entry[-1].name.bits &= ~S_VALUE_BITS_LAST;
+    }
+    (*obj)->num_entries++;
+    S_container_dirty(&(*obj)->base, S_WRITE_CACHE_SLOT_ALL);
+    return S_ERROR_CODE_OK;
+}
+
+/*
+ * Turns a packed array back into an array of values, before
+ * it is given an element which is not a number.
+ */
+static int S_array_unpack(S_array_t *arr) {
+    if (S_array_slots(arr) == NULL) {
         return 0;
     }
-    free(s);
+    free(arr->numbers);
+    arr->numbers = NULL;
     return 1;
 }
 
-/* ------------------------------------------------ */
-
-/* -------------------- Boolean -------------------- */
+static S_error_code_t S_array_set_value(S_array_t **arr, size_t i, S_value_t *value) {
+    S_value_t      *values;
+    S_error_code_t res;
 
-typedef struct {
-    S_value_t this_value;
-    S_bool_t  value;
-} S_boolean_t;
+    if (arr == NULL || *arr == NULL) {
+        S_value_destroy(value);
+        return S_ERROR_CODE_OBJECT_NOT_FOUND;
+    }
+    if (i >= (*arr)->num_values) {
+        S_value_destroy(value);
+        return S_ERROR_CODE_OUT_OF_BOUNDS;
+    }
+    if ((res = S_container_check(&(*arr)->base)) != S_ERROR_CODE_OK) {
+        S_value_destroy(value);
+        return res;
+    }
+    if ((*arr)->numbers != NULL) {
+        if (value->type == S_VALUE_TYPE_NUMBER) {
+            (*arr)->numbers[i] = value->as.number;
+            if ((values = S_array_values(*arr)) != NULL) {
+                values[i] = *value;
+            }
+            S_container_dirty(&(*arr)->base, i);
+            return S_ERROR_CODE_OK;
+        }
+        if (S_array_unpack(*arr) == 0) {
+            S_value_destroy(value);
+            return S_ERROR_CODE_MALLOC_ERR;
+        }
+    }
+    S_value_release(&(*arr)->values[i], &(*arr)->base);
+    (*arr)->values[i] = *value;
+    S_container_dirty(&(*arr)->base, i);
+    return S_ERROR_CODE_OK;
+}
 
-static S_boolean_t *S_boolean_create(void) {
-    S_boolean_t *b;
+/*
+ * Checks the type of a child container about to be modified
+ * and unshares it. The owner holding the slot is already
+ * unshared.
+ */
+static S_value_t *S_value_edit_slot(S_value_t *slot, S_value_type_t type, S_container_t *owner, S_error_code_t *err) {
+    S_error_code_t res;
 
-    b = malloc(sizeof *b);
-    if (b == NULL) {
+    if (slot->type != type) {
+        if (err) {
+            *err = S_ERROR_CODE_INVALID_TYPE;
+        }
         return NULL;
     }
-    b->this_value.type = S_VALUE_TYPE_BOOLEAN;
-    b->value = 0;
-    return b;
+    if (type == S_VALUE_TYPE_OBJECT) {
+        res = S_object_unshare(&slot->as.object, owner);
+    } else {
+        res = S_array_unshare(&slot->as.array, owner);
+    }
+    if (res == S_ERROR_CODE_OK) {
+        S_container_adopt(owner, slot);
+    }
+    if (err) {
+        *err = res;
+    }
+    return res == S_ERROR_CODE_OK ? slot : NULL;
 }
 
-static S_boolean_t *S_parse_boolean(S_ctx *ctx) {
-    S_boolean_t *b;
+static S_value_t *S_object_edit(S_object_t *obj, const char *name, S_value_type_t type, S_error_code_t *err) {
+    S_error_code_t res;
+    size_t         len;
+    size_t         i;
 
-    b = S_boolean_create();
-    if (b == NULL) {
+    if (obj == NULL || *obj == NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+        }
         return NULL;
     }
-    if (*ctx->ptr == 't') {
-        if (ctx->ptr + 4 >= ctx->end) {
-            S_value_destroy((S_value_t **) &b);
-            return NULL;
+    if ((res = S_container_check(&(*obj)->base)) != S_ERROR_CODE_OK
+            || (res = S_object_unshare(obj, NULL)) != S_ERROR_CODE_OK) {
+        if (err) {
+            *err = res;
         }
-        if (strncmp(ctx->ptr, "true", 4) != 0) {
-            S_value_destroy((S_value_t **) &b);
-            return NULL;
+        return NULL;
+    }
+    len = strlen(name);
+    for (i = 0; i < (*obj)->num_entries; i++) {
+        if (S_object_entry_name_equals(&(*obj)->entries[i], name, len)) {
+            S_container_dirty(&(*obj)->base, i);
+            return S_value_edit_slot(&(*obj)->entries[i].value, type, &(*obj)->base, err);
         }
-        ctx->ptr += 4;
-        b->value = 1;
-    } else if (*ctx->ptr == 'f') {
-        if (ctx->ptr + 5 >= ctx->end) {
-            S_value_destroy((S_value_t **) &b);
-            return NULL;
+    }
+    if (err) {
+        *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+    }
+    return NULL;
+}
+
+static S_value_t *S_array_edit(S_array_t **arr, size_t i, S_value_type_t type, S_error_code_t *err) {
+    S_error_code_t res;
+
+    if (arr == NULL || *arr == NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
         }
-        if (strncmp(ctx->ptr, "false", 5) != 0) {
-            S_value_destroy((S_value_t **) &b);
-            return NULL;
+        return NULL;
+    }
+    if (i >= (*arr)->num_values) {
+        if (err) {
+            *err = S_ERROR_CODE_OUT_OF_BOUNDS;
+        }
+        return NULL;
+    }
+    if ((*arr)->numbers != NULL) {
+        if (err) {
+            *err = S_ERROR_CODE_INVALID_TYPE;
+        }
+        return NULL;
+    }
+    if ((res = S_container_check(&(*arr)->base)) != S_ERROR_CODE_OK) {
+        if (err) {
+            *err = res;
         }
-        ctx->ptr += 5;
-        b->value = 0;
-    } else {
-        S_value_destroy((S_value_t **) &b);
         return NULL;
     }
-    return b;
+    S_container_dirty(&(*arr)->base, i);
+    return S_value_edit_slot(&(*arr)->values[i], type, &(*arr)->base, err);
 }
 
-static int S_write_boolean(S_write_ctx_t *ctx, S_boolean_t *b) {
-    if (b->value == 1) {
-        if (S_write_add_string(ctx, "true") == 0) {
+S_error_code_t S_object_set_bool(S_object_t *obj, const char *name, S_bool_t value) {
+    S_value_t slot;
+
+    S_value_set_bool(&slot, value);
+    return S_object_set_value(obj, name, &slot);
+}
+
+S_error_code_t S_object_set_number(S_object_t *obj, const char *name, double value) {
+    S_value_t slot;
+
+    S_value_set_number(&slot, value);
+    return S_object_set_value(obj, name, &slot);
+}
+
+S_error_code_t S_object_set_string(S_object_t *obj, const char *name, const char *value) {
+    S_value_t slot;
+
+    if (S_value_set_string(NULL, &slot, value, strlen(value)) == 0) {
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    return S_object_set_value(obj, name, &slot);
+}
+
+S_error_code_t S_object_set_null(S_object_t *obj, const char *name) {
+    S_value_t slot;
+
+    S_value_set_null(&slot);
+    return S_object_set_value(obj, name, &slot);
+}
+
+S_error_code_t S_array_set_bool(S_array_t **arr, size_t i, S_bool_t value) {
+    S_value_t slot;
+
+    S_value_set_bool(&slot, value);
+    return S_array_set_value(arr, i, &slot);
+}
+
+S_error_code_t S_array_set_number(S_array_t **arr, size_t i, double value) {
+    S_value_t slot;
+
+    S_value_set_number(&slot, value);
+    return S_array_set_value(arr, i, &slot);
+}
+
+S_error_code_t S_array_set_string(S_array_t **arr, size_t i, const char *value) {
+    S_value_t slot;
+
+    if (S_value_set_string(NULL, &slot, value, strlen(value)) == 0) {
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    return S_array_set_value(arr, i, &slot);
+}
+
+S_error_code_t S_array_set_null(S_array_t **arr, size_t i) {
+    S_value_t slot;
+
+    S_value_set_null(&slot);
+    return S_array_set_value(arr, i, &slot);
+}
+
+S_object_t *S_object_edit_object(S_object_t *obj, const char *name, S_error_code_t *err) {
+    S_value_t *slot;
+
+    slot = S_object_edit(obj, name, S_VALUE_TYPE_OBJECT, err);
+    return slot == NULL ? NULL : &slot->as.object;
+}
+
+S_array_t **S_object_edit_array(S_object_t *obj, const char *name, S_error_code_t *err) {
+    S_value_t *slot;
+
+    slot = S_object_edit(obj, name, S_VALUE_TYPE_ARRAY, err);
+    return slot == NULL ? NULL : &slot->as.array;
+}
+
+S_object_t *S_array_edit_object(S_array_t **arr, size_t i, S_error_code_t *err) {
+    S_value_t *slot;
+
+    slot = S_array_edit(arr, i, S_VALUE_TYPE_OBJECT, err);
+    return slot == NULL ? NULL : &slot->as.object;
+}
+
+S_array_t **S_array_edit_array(S_array_t **arr, size_t i, S_error_code_t *err) {
+    S_value_t *slot;
+
+    slot = S_array_edit(arr, i, S_VALUE_TYPE_ARRAY, err);
+    return slot == NULL ? NULL : &slot->as.array;
+}
+
+/* -------------------- Index -------------------- */
+
+#define S_INDEX_MAGIC      "SJIX"
+#define S_INDEX_VERSION    2
+#define S_INDEX_BYTE_ORDER 0x01020304 // Read back swapped on another byte order
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t first_child;
+    uint64_t num_children;
+} S_index_entry_t;
+
+typedef struct s_S_index {
+    uint64_t        source_size;
+    S_index_entry_t *entries;
+    size_t          num_entries;
+    size_t          entries_size;
+    S_index_entry_t *children;
+    size_t          num_children;
+    size_t          children_size;
+} S_index_t;
+
+/*
+ * Mapped (or, without mmap, read) range of a file.
+ */
+typedef struct {
+    char   *data;
+    size_t len;
+    void   *base;
+    size_t base_len;
+} S_file_range_t;
+
+static int S_file_range_open(S_file_range_t *range, const char *file, uint64_t offset, uint64_t len, uint64_t *file_size) {
+#ifdef S_HAVE_MMAP
+    struct stat st;
+    uint64_t    page;
+    int         fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    *file_size = st.st_size;
+    if (len == (uint64_t) -1) {
+        len = st.st_size - offset;
+    }
+    if (offset > (uint64_t) st.st_size || len > (uint64_t) st.st_size - offset) {
+        close(fd);
+        return 0;
+    }
+    page = offset - offset % sysconf(_SC_PAGESIZE);
+    range->base_len = offset - page + len;
+    range->base = NULL;
+    if (range->base_len > 0) {
+        range->base = mmap(NULL, range->base_len, PROT_READ, MAP_PRIVATE, fd, page);
+    }
+    close(fd);
+    if (range->base == MAP_FAILED) {
+        return 0;
+    }
+    range->data = (char *) range->base + (offset - page);
+    range->len = len;
+    return 1;
+#else
+    FILE *f;
+    long size;
+
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+        fclose(f);
+        return 0;
+    }
+    *file_size = size;
+    if (len == (uint64_t) -1) {
+        len = size - offset;
+    }
+    if (offset > (uint64_t) size || len > (uint64_t) size - offset
+            || fseek(f, (long) offset, SEEK_SET) != 0) {
+        fclose(f);
+        return 0;
+    }
+    range->base = malloc(len + 1);
+    if (range->base == NULL || fread(range->base, 1, len, f) != len) {
+        free(range->base);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    range->base_len = len;
+    range->data = range->base;
+    range->len = len;
+    return 1;
+#endif
+}
+
+static void S_file_range_close(S_file_range_t *range) {
+#ifdef S_HAVE_MMAP
+    if (range->base != NULL) {
+        munmap(range->base, range->base_len);
+    }
+#else
+    free(range->base);
+#endif
+}
+
+static int S_index_push(S_index_entry_t **entries, size_t *len, size_t *size, S_index_entry_t *entry) {
+    S_index_entry_t *temp;
+
+    if (*len == *size) {
+        *size = *size == 0 ? S_STACK_SIZE : 2 * *size;
+        temp = realloc(*entries, sizeof **entries * *size);
+        if (temp == NULL) {
             return 0;
         }
+        *entries = temp;
+    }
+    (*entries)[(*len)++] = *entry;
+    return 1;
+}
+
+/*
+ * Records the offsets of the elements (or member values) of
+ * the container at ctx, descending into the elements which
+ * are containers themselves if depth allows it.
+ */
+static int S_index_scan(S_ctx *ctx, const char *data, S_index_t *idx, S_index_entry_t *parent, int depth) {
+    S_index_entry_t entry;
+    char            close;
+    char            *start;
+    int             res;
+
+    close = *ctx->ptr == '[' ? ']' : '}';
+    ctx->ptr++;
+    S_skip_whitespace(ctx);
+    if (ctx->ptr != ctx->end && *ctx->ptr == close) {
+        ctx->ptr++;
         return 1;
-    } else if (b->value == 0) {
-        if (S_write_add_string(ctx, "false") == 0) {
+    }
+    for (;;) {
+        if (close == '}') {
+            if (ctx->ptr == ctx->end || *ctx->ptr != '"' || S_skip_string(ctx) == 0) {
+                return 0;
+            }
+            S_skip_whitespace(ctx);
+            if (ctx->ptr == ctx->end || *ctx->ptr != ':') {
+                return 0;
+            }
+            ctx->ptr++;
+            S_skip_whitespace(ctx);
+        }
+        if (ctx->ptr == ctx->end) {
             return 0;
         }
-        return 1;
+        start = ctx->ptr;
+        entry.first_child = idx->num_children;
+        entry.num_children = 0;
+        if (parent == NULL && depth > 1 && (*ctx->ptr == '[' || *ctx->ptr == '{')) {
+            res = S_index_scan(ctx, data, idx, &entry, depth);
+        } else {
+            res = S_skip_value(ctx);
+        }
+        if (res == 0) {
+            return 0;
+        }
+        entry.offset = start - data;
+        entry.length = ctx->ptr - start;
+        if (parent == NULL) {
+            res = S_index_push(&idx->entries, &idx->num_entries, &idx->entries_size, &entry);
+        } else {
+            res = S_index_push(&idx->children, &idx->num_children, &idx->children_size, &entry);
+            parent->num_children++;
+        }
+        if (res == 0) {
+            return 0;
+        }
+        S_skip_whitespace(ctx);
+        if (ctx->ptr == ctx->end) {
+            return 0;
+        }
+        if (*ctx->ptr == ',') {
+            ctx->ptr++;
+            S_skip_whitespace(ctx);
+            continue;
+        }
+        if (*ctx->ptr == close) {
+            ctx->ptr++;
+            return 1;
+        }
+        return 0;
     }
-    return 0;
 }
 
-/* ------------------------------------------------- */
+static S_index_t *S_index_create(void) {
+    S_index_t *idx;
 
-/* -------------------- Null -------------------- */
+    idx = malloc(sizeof *idx);
+    if (idx == NULL) {
+        return NULL;
+    }
+    idx->source_size = 0;
+    idx->entries = NULL;
+    idx->num_entries = 0;
+    idx->entries_size = 0;
+    idx->children = NULL;
+    idx->num_children = 0;
+    idx->children_size = 0;
+    return idx;
+}
 
-typedef struct {
-    S_value_t this_value;
-} S_null_t;
+S_index_t *S_index_build(const char *data, size_t sz, int depth) {
+    S_index_t *idx;
+    S_ctx     ctx;
+
+    S_ctx_init(&ctx, data, sz, S_PARSE_FLAG_NONE);
+    S_skip_whitespace(&ctx);
+    if (ctx.ptr == ctx.end || (*ctx.ptr != '[' && *ctx.ptr != '{')) {
+        return NULL;
+    }
+    idx = S_index_create();
+    if (idx == NULL) {
+        return NULL;
+    }
+    idx->source_size = sz;
+    if (S_index_scan(&ctx, data, idx, NULL, depth) == 0) {
+        S_index_destroy(&idx);
+        return NULL;
+    }
+    return idx;
+}
+
+S_index_t *S_index_build_file(const char *file, int depth) {
+    S_file_range_t range;
+    S_index_t      *idx;
+    uint64_t       size;
+
+    if (S_file_range_open(&range, file, 0, (uint64_t) -1, &size) == 0) {
+        return NULL;
+    }
+    idx = S_index_build(range.data, range.len, depth);
+    S_file_range_close(&range);
+    return idx;
+}
+
+static char *S_index_path(const char *file) {
+    char   *path;
+    size_t len;
+
+    len = strlen(file);
+    path = malloc(len + sizeof S_INDEX_SUFFIX);
+    if (path == NULL) {
+        return NULL;
+    }
+    memcpy(path, file, len);
+    memcpy(&path[len], S_INDEX_SUFFIX, sizeof S_INDEX_SUFFIX);
+    return path;
+}
+
+S_error_code_t S_index_save(S_index_t *idx, const char *file) {
+    uint32_t header[3];
+    uint64_t counts[3];
+    char     *path;
+    FILE     *f;
+    int      ok;
+
+    path = S_index_path(file);
+    if (path == NULL) {
+        return S_ERROR_CODE_MALLOC_ERR;
+    }
+    f = fopen(path, "wb");
+    free(path);
+    if (f == NULL) {
+        return S_ERROR_CODE_IO_ERR;
+    }
+    header[0] = S_INDEX_VERSION;
+    header[1] = S_INDEX_BYTE_ORDER;
+    header[2] = sizeof (S_index_entry_t);
+    counts[0] = idx->source_size;
+    counts[1] = idx->num_entries;
+    counts[2] = idx->num_children;
+    ok = fwrite(S_INDEX_MAGIC, 4, 1, f) == 1
+        && fwrite(header, sizeof header, 1, f) == 1
+        && fwrite(counts, sizeof counts, 1, f) == 1
+        && fwrite(idx->entries, sizeof *idx->entries, idx->num_entries, f) == idx->num_entries
+        && fwrite(idx->children, sizeof *idx->children, idx->num_children, f) == idx->num_children;
+    if (fclose(f) != 0 || !ok) {
+        return S_ERROR_CODE_IO_ERR;
+    }
+    return S_ERROR_CODE_OK;
+}
+
+/*
+ * Checks that an entry read from a file lies within the source,
+ * and that its children lie within the index.
+ */
+static int S_index_entry_check(S_index_t *idx, S_index_entry_t *entry) {
+    return entry->offset <= idx->source_size
+        && entry->length <= idx->source_size - entry->offset
+        && entry->first_child <= idx->num_children
+        && entry->num_children <= idx->num_children - entry->first_child;
+}
+
+/*
+ * Reads the counts of the index, which have to match the size
+ * of the rest of the file.
+ */
+static int S_index_load_counts(FILE *f, uint64_t *counts) {
+    uint32_t header[3];
+    char     magic[4];
+    long     start;
+    long     end;
+
+    if (fread(magic, 4, 1, f) != 1 || memcmp(magic, S_INDEX_MAGIC, 4) != 0
+            || fread(header, sizeof header, 1, f) != 1 || header[0] != S_INDEX_VERSION
+            || header[1] != S_INDEX_BYTE_ORDER || header[2] != sizeof (S_index_entry_t)
+            || fread(counts, sizeof *counts, 3, f) != 3) {
+        return 0;
+    }
+    if ((start = ftell(f)) < 0 || fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < 0
+            || fseek(f, start, SEEK_SET) != 0) {
+        return 0;
+    }
+    return counts[1] <= (uint64_t) (end - start) / sizeof (S_index_entry_t)
+        && counts[2] == (uint64_t) (end - start) / sizeof (S_index_entry_t) - counts[1]
+        && (uint64_t) (end - start) % sizeof (S_index_entry_t) == 0;
+}
 
-static S_null_t *S_null_create(void) {
-    S_null_t *n;
+S_index_t *S_index_load(const char *file) {
+    S_index_t *idx;
+    uint64_t  counts[3];
+    char      *path;
+    FILE      *f;
+    size_t    i;
+    int       ok;
 
-    n = malloc(sizeof *n);
-    if (n == NULL) {
+    path = S_index_path(file);
+    if (path == NULL) {
+        return NULL;
+    }
+    f = fopen(path, "rb");
+    free(path);
+    if (f == NULL) {
+        return NULL;
+    }
+    if (S_index_load_counts(f, counts) == 0) {
+        fclose(f);
+        return NULL;
+    }
+    idx = S_index_create();
+    if (idx == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    idx->source_size = counts[0];
+    idx->num_entries = idx->entries_size = counts[1];
+    idx->num_children = idx->children_size = counts[2];
+    idx->entries = malloc(sizeof *idx->entries * (idx->num_entries + 1));
+    idx->children = malloc(sizeof *idx->children * (idx->num_children + 1));
+    ok = idx->entries != NULL && idx->children != NULL
+        && fread(idx->entries, sizeof *idx->entries, idx->num_entries, f) == idx->num_entries
+        && fread(idx->children, sizeof *idx->children, idx->num_children, f) == idx->num_children;
+    fclose(f);
+    for (i = 0; ok && i < idx->num_entries; i++) {
+        ok = S_index_entry_check(idx, &idx->entries[i]);
+    }
+    for (i = 0; ok && i < idx->num_children; i++) {
+        ok = S_index_entry_check(idx, &idx->children[i]) && idx->children[i].num_children == 0;
+    }
+    if (!ok) {
+        S_index_destroy(&idx);
         return NULL;
     }
-    n->this_value.type = S_VALUE_TYPE_NULL;
-    return n;
+    return idx;
+}
+
+size_t S_index_count(S_index_t *idx) {
+    if (idx == NULL) {
+        return 0;
+    }
+    return idx->num_entries;
+}
+
+size_t S_index_child_count(S_index_t *idx, size_t i) {
+    if (idx == NULL || i >= idx->num_entries) {
+        return 0;
+    }
+    return idx->entries[i].num_children;
 }
 
-static S_null_t *S_parse_null(S_ctx *ctx) {
-    S_null_t *n;
+static S_object_t S_parse_index_entry(const char *file, S_index_t *idx, S_index_entry_t *entry) {
+    S_file_range_t range;
+    S_object_t     obj;
+    uint64_t       size;
 
-    if (*ctx->ptr != 'n') {
+    if (S_file_range_open(&range, file, entry->offset, entry->length, &size) == 0) {
         return NULL;
     }
-    n = S_null_create();
-    if (n == NULL) {
+    obj = NULL;
+    if (size == idx->source_size) { // Otherwise the index is stale
+        obj = S_parse(range.data, range.len);
+    }
+    S_file_range_close(&range);
+    return obj;
+}
+
+S_object_t S_parse_index_element(const char *file, S_index_t *idx, size_t i) {
+    if (i >= idx->num_entries) {
         return NULL;
     }
-    if (strncmp(ctx->ptr, "null", 4) != 0) {
-        S_value_destroy((S_value_t **) &n);
+    return S_parse_index_entry(file, idx, &idx->entries[i]);
+}
+
+S_object_t S_parse_index_child(const char *file, S_index_t *idx, size_t i, size_t j) {
+    if (i >= idx->num_entries || j >= idx->entries[i].num_children) {
         return NULL;
     }
-    ctx->ptr += 4;
-    return n;
+    return S_parse_index_entry(file, idx, &idx->children[idx->entries[i].first_child + j]);
+}
+
+void S_index_destroy(S_index_t **idx) {
+    if (idx == NULL || *idx == NULL) {
+        return;
+    }
+    free((*idx)->entries);
+    free((*idx)->children);
+    free(*idx);
+    *idx = NULL;
 }
 
-static int S_write_null(S_write_ctx_t *ctx, S_null_t *n) {
-    if (S_write_add_string(ctx, "null") == 0) {
+/* ----------------------------------------------- */
+
+/* -------------------- Image -------------------- */
+
+#define S_IMAGE_MAGIC      "SJIM"
+#define S_IMAGE_VERSION    2
+#define S_IMAGE_BYTE_ORDER 0x01020304
+#define S_IMAGE_ALIGN      8
+
+/*
+ * An image is the header followed by the bodies of a document,
+ * laid out as in memory with relative pointers (see
+ * S_RELATIVE). Every body is pooled: read only, no counts and
+ * no caches.
+ */
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t pointer_size;
+    uint32_t value_size;
+    uint32_t layout;
+    uint64_t size;
+    uint64_t root;
+} S_image_header_t;
+
+/*
+ * State of S_image_verify. Bodies are saved in the order they
+ * are visited, so each one has to start after the end of the
+ * previous one: no body is visited twice.
+ */
+typedef struct {
+    S_image_t *image;
+    size_t    next;
+} S_image_verify_t;
+
+typedef struct s_S_image {
+    S_file_range_t range;
+    S_object_t     root;
+} S_image_t;
+
+/*
+ * Reserves size zeroed bytes in the image being built. Returns
+ * their offset, 0 on failure (the header is at 0).
+ */
+static size_t S_image_alloc(S_write_ctx_t *img, size_t size) {
+    size_t pad;
+    size_t at;
+
+    pad = (S_IMAGE_ALIGN - img->len % S_IMAGE_ALIGN) % S_IMAGE_ALIGN;
+    if (S_write_ctx_reallocate_if_needed(img, pad + size) == 0) {
         return 0;
     }
-    return 1;
+    at = img->len + pad;
+    memset(&img->data[img->len], 0, pad + size);
+    img->len = at + size;
+    return at;
 }
 
-/* -------------------- Object -------------------- */
+/*
+ * Points the pointer field at offset field to the offset target.
+ */
+static void S_image_link(S_write_ctx_t *img, size_t field, size_t target) {
+    void *rel;
 
-typedef struct s_S_object_entry {
-    S_value_t               this_value;
-    S_string_t              *name;
-    S_value_t               *value;
-    struct s_S_object_entry *next;
-} S_object_entry_t;
+    rel = (void *) ((intptr_t) target - (intptr_t) field);
+    memcpy(&img->data[field], &rel, sizeof rel);
+}
 
-static S_object_t S_object_create(void) {
-    S_object_t obj;
+static void S_image_body_init(S_write_ctx_t *img, size_t at) {
+    S_body_t body;
 
-    obj = malloc(sizeof *obj);
-    if (obj == NULL) {
-        return NULL;
-    }
-    obj->name = NULL;
-    obj->value = NULL;
-    obj->next = NULL;
-    obj->this_value.type = S_VALUE_TYPE_OBJECT;
-    return obj;
+    body.refs = S_VALUE_REFS_POOLED;
+    body.flags = S_BODY_FLAG_IMAGE;
+    memcpy(&img->data[at], &body, sizeof body);
 }
 
-static void S_object_destroy(S_object_t *obj) {
-    if ((*obj)->name != NULL) {
-        S_string_destroy(&(*obj)->name);
-    }
-    if ((*obj)->value != NULL) {
-        S_value_destroy(&(*obj)->value);
-    }
-    if ((*obj)->next != NULL) {
-        S_object_destroy(&(*obj)->next);
+static int    S_image_put_value(S_write_ctx_t *img, size_t at, S_value_t *value);
+
+static size_t S_image_put_string(S_write_ctx_t *img, S_string_t *str) {
+    size_t at;
+
+    at = S_image_alloc(img, sizeof *str + str->len + 1);
+    if (at == 0) {
+        return 0;
     }
-    free(*obj);
-    *obj = NULL;
+    S_image_body_init(img, at);
+    memcpy(&img->data[at + offsetof(S_string_t, len)], &str->len, sizeof str->len);
+    memcpy(&img->data[at + offsetof(S_string_t, data)], str->data, str->len + 1);
+    return at;
 }
 
-static S_object_t S_parse_object(S_ctx *ctx) {
-    S_object_t obj;
+/*
+ * Lexemes are stored converted: the image is mapped read only.
+ */
+static size_t S_image_put_lexeme(S_write_ctx_t *img, S_value_t *value) {
+    S_body_t   body;
+    const char *data;
+    char       buf[S_LEXEME_INLINE_MAX + 1];
+    double     number;
+    size_t     len;
+    size_t     at;
 
-    obj = S_object_create();
-    if (obj == NULL) {
-        return NULL;
-    }
-    if (S_skip_over_if_possible(ctx) == 0) {
-        S_object_destroy(&obj);
-        return NULL;
-    }
-    if (*ctx->ptr == '}') {
-        S_skip_over_if_possible(ctx);
-        return obj;
-    }
-    obj->name = S_parse_string(ctx);
-    if (obj->name == NULL) {
-        S_object_destroy(&obj);
-        return NULL;
-    }
-    S_skip_whitespace(ctx);
-    if (*ctx->ptr != ':') {
-        S_object_destroy(&obj);
-        return NULL;
+    data = S_value_lexeme(value, buf, &len);
+    number = S_value_number(value);
+    at = S_image_alloc(img, sizeof (S_lexeme_t) + len + 1);
+    if (at == 0) {
+        return 0;
     }
-    S_skip_whitespace(ctx); // Not sure if necessary?
-    if (S_skip_over_if_possible(ctx) == 0) {
-        S_object_destroy(&obj);
-        return NULL;
+    body.refs = S_VALUE_REFS_POOLED;
+    body.flags = S_BODY_FLAG_IMAGE;
+    memcpy(&img->data[at], &body, sizeof body);
+    memcpy(&img->data[at + offsetof(S_lexeme_t, value)], &number, sizeof number);
+    memcpy(&img->data[at + offsetof(S_lexeme_t, len)], &len, sizeof len);
+    memcpy(&img->data[at + offsetof(S_lexeme_t, data)], data, len + 1);
+    return at;
+}
+
+static size_t S_image_put_array(S_write_ctx_t *img, S_array_t *arr) {
+    S_value_t slot;
+    S_value_t *values;
+    double    *numbers;
+    size_t    at;
+    size_t    data;
+    size_t    i;
+
+    at = S_image_alloc(img, sizeof *arr);
+    if (at == 0) {
+        return 0;
     }
-    obj->value = S_parse_value(ctx);
-    if (obj->value == NULL) {
-        S_object_destroy(&obj);
-        return NULL;
+    S_image_body_init(img, at);
+    memcpy(&img->data[at + offsetof(S_array_t, num_values)], &arr->num_values, sizeof arr->num_values);
+    memcpy(&img->data[at + offsetof(S_array_t, size)], &arr->num_values, sizeof arr->num_values);
+    if (arr->num_values == 0) {
+        return at;
     }
-    S_skip_whitespace(ctx);
-    if (*ctx->ptr == ',') {
-        obj->next = S_parse_object(ctx);
-        if (obj->next == NULL) {
-            return NULL;
+    numbers = S_array_numbers(arr);
+    if (numbers != NULL) {
+        data = S_image_alloc(img, sizeof *numbers * arr->num_values);
+        if (data == 0) {
+            return 0;
         }
-    } else if (*ctx->ptr != '}') {
-        S_object_destroy(&obj);
-        return NULL;
-    }
-    S_skip_over_if_possible(ctx);
-    return obj;
-}
-
-static int S_write_object(S_write_ctx_t *ctx, S_object_t obj, int sub /* sub object AKA {} already written */) {
-    if (sub == 0) {    
-        if (S_write_add_string(ctx, "{") == 0) {
+        memcpy(&img->data[data], numbers, sizeof *numbers * arr->num_values);
+        S_image_link(img, at + offsetof(S_array_t, numbers), data);
+        data = S_image_alloc(img, sizeof (S_value_t) * arr->num_values);
+        if (data == 0) {
             return 0;
         }
+        S_image_link(img, at + offsetof(S_array_t, values), data);
+        for (i = 0; i < arr->num_values; i++) {
+            S_value_set_number(&slot, numbers[i]);
+            memcpy(&img->data[data + i * sizeof slot], &slot, sizeof slot);
+        }
+        return at;
+    }
+    data = S_image_alloc(img, sizeof (S_value_t) * arr->num_values);
+    if (data == 0) {
+        return 0;
     }
-    if (obj->name == NULL) {
-        if (S_write_add_string(ctx, "}") == 0) {
+    S_image_link(img, at + offsetof(S_array_t, values), data);
+    values = S_array_values(arr);
+    for (i = 0; i < arr->num_values; i++) {
+        if (S_image_put_value(img, data + i * sizeof (S_value_t), &values[i]) == 0) {
             return 0;
         }
-        return 1;
     }
-    if (S_write_string(ctx, obj->name) == 0) {
+    return at;
+}
+
+static size_t S_image_put_object(S_write_ctx_t *img, S_object_t obj) {
+    S_object_entry_t *entries;
+    size_t           at;
+    size_t           data;
+    size_t           entry;
+    size_t           i;
+
+    at = S_image_alloc(img, sizeof *obj);
+    if (at == 0) {
         return 0;
     }
-    if (S_write_add_string(ctx, ":") == 0) {
-        return 0;
+    S_image_body_init(img, at);
+    memcpy(&img->data[at + offsetof(struct s_S_object, num_entries)], &obj->num_entries, sizeof obj->num_entries);
+    memcpy(&img->data[at + offsetof(struct s_S_object, size)], &obj->num_entries, sizeof obj->num_entries);
+    if (obj->num_entries == 0) {
+        return at;
     }
-    if (S_write_value(ctx, obj->value) == 0) {
+    data = S_image_alloc(img, sizeof (S_object_entry_t) * obj->num_entries);
+    if (data == 0) {
         return 0;
     }
-    if (obj->next != NULL) {
-        if (S_write_add_string(ctx, ",") == 0) {
-            return 0;
-        }
-        if (S_write_object(ctx, obj->next, 1 /* 1 as sub object */) == 0) {
+    S_image_link(img, at + offsetof(struct s_S_object, entries), data);
+    entries = S_object_entries(obj);
+    for (i = 0; i < obj->num_entries; i++) {
+        entry = data + i * sizeof (S_object_entry_t);
+        if (S_image_put_value(img, entry + offsetof(S_object_entry_t, name), &entries[i].name) == 0
+                || S_image_put_value(img, entry + offsetof(S_object_entry_t, value), &entries[i].value) == 0) {
             return 0;
         }
     }
-    if (sub == 1) {
-        return 1;
-    }
-    if (S_write_add_string(ctx, "}") == 0) {
-        return 0;
-    }
-    return 1;
+    return at;
 }
 
-/* ------------------------------------------------ */
+/*
+ * Writes the value into the slot at offset at, and its body
+ * after the current end of the image.
+ */
+static int S_image_put_value(S_write_ctx_t *img, size_t at, S_value_t *value) {
+    S_value_t     slot;
+    unsigned char bits;
+    size_t        body;
 
-static S_value_t *S_parse_value(S_ctx *ctx) {
-    if (*ctx->ptr == '"') {
-        return (S_value_t *) S_parse_string(ctx);
-    } else if (*ctx->ptr == '{') {
-        return (S_value_t *) S_parse_object(ctx);
-    } else if (*ctx->ptr == '[') {
-        return (S_value_t *) S_parse_array(ctx);
-    } else if (S_number_check_if_possible(*ctx->ptr)) {
-        return (S_value_t *) S_parse_number(ctx);
-    } else if (*ctx->ptr == 't' || *ctx->ptr == 'f') {
-        return (S_value_t *) S_parse_boolean(ctx);
-    } else if (*ctx->ptr == 'n') {
-        return (S_value_t *) S_parse_null(ctx);
-    } else {
-        return NULL;
+    S_value_copy_slot(&slot, value);
+    if (slot.type == S_VALUE_TYPE_NUMBER && (slot.bits & S_VALUE_BITS_INLINE)) {
+        slot.as.number = S_value_number(value); // The image is mapped read only
     }
-}
-
-static void S_value_destroy(S_value_t **value) {
-    switch ((*value)->type) {
+    memcpy(&img->data[at], &slot, sizeof slot);
+    if (!S_value_has_body(value)) {
+        return 1;
+    }
+    switch (value->type) {
         case S_VALUE_TYPE_STRING:
-            S_string_destroy((S_string_t **) value);
+            body = S_image_put_string(img, (S_string_t *) S_value_body(value));
             break;
-        case S_VALUE_TYPE_OBJECT:
-            S_object_destroy((S_object_t *) value);
+        case S_VALUE_TYPE_NUMBER:
+            body = S_image_put_lexeme(img, value);
             break;
         case S_VALUE_TYPE_ARRAY:
-            S_array_destroy((S_array_t **) value);
+            body = S_image_put_array(img, S_value_array(value));
             break;
         default:
-            free(*value);
-            *value = NULL;
+            body = S_image_put_object(img, S_value_object(value));
             break;
     }
-}
-
-S_object_t S_parse(const char *data, size_t sz) {
-    S_ctx ctx;
-
-    ctx.ptr = (char *) data;
-    ctx.end = (char *) data + sz;
-    return S_parse_object(&ctx);
-}
-
-void S_destroy(S_object_t *obj) {
-    S_object_destroy(obj);
-}
-
-static int S_write_value(S_write_ctx_t *ctx, S_value_t *val) {
-    switch (val->type) {
-        case S_VALUE_TYPE_OBJECT:
-            return S_write_object(ctx, (S_object_t) val, 0);
-            break;
-        case S_VALUE_TYPE_ARRAY:
-            return S_write_array(ctx, (S_array_t *) val);
-            break;
-        case S_VALUE_TYPE_STRING:
-            return S_write_string(ctx, (S_string_t *) val);
-            break;
-        case S_VALUE_TYPE_NUMBER:
-            return S_write_number(ctx, (S_number_t *) val);
-            break;
-        case S_VALUE_TYPE_BOOLEAN:
-            return S_write_boolean(ctx, (S_boolean_t *) val);
-            break;
-        case S_VALUE_TYPE_NULL:
-            return S_write_null(ctx, (S_null_t *) val);
-            break;
-        default:
-            return 0;
+    if (body == 0) {
+        return 0;
     }
+    bits = value->bits | S_VALUE_BITS_IMAGE;
+    memcpy(&img->data[at + offsetof(S_value_t, bits)], &bits, sizeof bits);
+    S_image_link(img, at + offsetof(S_value_t, as), body);
+    return 1;
 }
 
-char *S_write(S_object_t obj) {
-    S_write_ctx_t ctx;
+S_error_code_t S_image_save(S_object_t obj, const char *file) {
+    S_write_ctx_t    img;
+    S_image_header_t header;
+    size_t           root;
+    FILE             *f;
+    int              ok;
 
     if (obj == NULL) {
-        return NULL;
+        return S_ERROR_CODE_OBJECT_NOT_FOUND;
     }
-    ctx = S_write_ctx_create();
-    if (ctx.data == NULL) {
-        return NULL;
+    img = S_write_ctx_create();
+    if (img.data == NULL) {
+        return S_ERROR_CODE_MALLOC_ERR;
     }
-    if (S_write_object(&ctx, obj, 0) == 0) {
-        S_write_ctx_destroy(&ctx);
+    img.len = sizeof header;
+    root = S_image_put_object(&img, obj);
+    if (root == 0) {
+        S_write_ctx_destroy(&img);
+        return S_ERROR_CODE_MALLOC_ERR;
     }
-    return ctx.data;
-}
-
-S_value_t *S_object_get(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_object_t curr;
+    memcpy(header.magic, S_IMAGE_MAGIC, 4);
+    header.version = S_IMAGE_VERSION;
+    header.byte_order = S_IMAGE_BYTE_ORDER;
+    header.pointer_size = sizeof (void *);
+    header.value_size = sizeof (S_value_t);
+    header.layout = S_VALUE_LAYOUT;
+    header.size = img.len;
+    header.root = root;
+    memcpy(img.data, &header, sizeof header);
 
-    for (curr = obj; curr != NULL; curr = curr->next) {
-        if (strcmp(curr->name->data, name) == 0) {
-            if (err) {
-                *err = S_ERROR_CODE_OK;
-            }
-            return curr->value;
-        }
+    f = fopen(file, "wb");
+    if (f == NULL) {
+        S_write_ctx_destroy(&img);
+        return S_ERROR_CODE_IO_ERR;
     }
-    if (err) {
-        *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+    ok = fwrite(img.data, 1, img.len, f) == img.len;
+    S_write_ctx_destroy(&img);
+    if (fclose(f) != 0 || !ok) {
+        return S_ERROR_CODE_IO_ERR;
     }
-    return NULL;
+    return S_ERROR_CODE_OK;
 }
 
-S_bool_t S_object_get_bool(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_object_get(obj, name, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_BOOLEAN, 0)
-    return ((S_boolean_t *) value)->value;
-}
-
-double S_object_get_number(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
+S_image_t *S_image_open(const char *file) {
+    S_image_t        *image;
+    S_image_header_t header;
+    uint64_t         size;
 
-    value = S_object_get(obj, name, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_NUMBER, 0.0)
-    return ((S_number_t *) value)->value;
+    image = malloc(sizeof *image);
+    if (image == NULL) {
+        return NULL;
+    }
+    if (S_file_range_open(&image->range, file, 0, (uint64_t) -1, &size) == 0) {
+        free(image);
+        return NULL;
+    }
+    if (image->range.len < sizeof header) {
+        S_image_close(&image);
+        return NULL;
+    }
+    memcpy(&header, image->range.data, sizeof header);
+    if (memcmp(header.magic, S_IMAGE_MAGIC, 4) != 0 || header.version != S_IMAGE_VERSION
+            || header.byte_order != S_IMAGE_BYTE_ORDER || header.pointer_size != sizeof (void *)
+            || header.value_size != sizeof (S_value_t) || header.layout != S_VALUE_LAYOUT
+            || header.size != image->range.len || header.root % S_IMAGE_ALIGN != 0
+            || header.root < sizeof header || header.root + sizeof *image->root > header.size) {
+        S_image_close(&image);
+        return NULL;
+    }
+    image->root = (S_object_t) (image->range.data + header.root);
+    return image;
 }
 
-S_object_t S_object_get_object(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_object_get(obj, name, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_OBJECT, NULL);
-    return (S_object_t) value;
+S_object_t S_image_root(S_image_t *image) {
+    return image == NULL ? NULL : image->root;
 }
 
-char *S_object_get_string(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
-    char      *s;
+/*
+ * Resolves the relative pointer in field to a body of size
+ * bytes, which must start after the previous body and end
+ * within the image. Returns NULL otherwise.
+ */
+static void *S_image_verify_body(S_image_verify_t *v, void *field, size_t size) {
+    intptr_t rel;
+    size_t   at;
+    size_t   to;
 
-    value = S_object_get(obj, name, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_STRING, NULL);
-    s = calloc(1, ((S_string_t *) value)->len + 1);
-    if (s == NULL) {
-        if (err) {
-            *err = S_ERROR_CODE_MALLOC_ERR;
-        }
+    memcpy(&rel, field, sizeof rel);
+    at = (size_t) ((char *) field - v->image->range.data);
+    if (rel <= 0 || (uintptr_t) rel > v->image->range.len - at) {
         return NULL;
     }
-    memcpy(s, ((S_string_t *) value)->data, ((S_string_t *) value)->len + 1);
-    return s;
+    to = at + (size_t) rel;
+    if (to < v->next || to % S_IMAGE_ALIGN != 0 || size > v->image->range.len - to) {
+        return NULL;
+    }
+    v->next = to + size;
+    return v->image->range.data + to;
 }
 
-S_array_t *S_object_get_array(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_object_get(obj, name, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_ARRAY, NULL);
-    return (S_array_t *) value;
+/*
+ * Checks the header of a body, and extends it by len bytes of
+ * text followed by a NUL.
+ */
+static int S_image_verify_text(S_image_verify_t *v, S_body_t *body, const char *data, size_t len) {
+    if (body->refs != S_VALUE_REFS_POOLED || body->flags != S_BODY_FLAG_IMAGE
+            || len >= v->image->range.len - v->next) {
+        return 0;
+    }
+    v->next += len + 1;
+    return data[len] == '\0';
 }
 
-S_bool_t S_object_is_null(S_object_t obj, const char *name, S_error_code_t *err) {
-    S_value_t *value;
+static int S_image_verify_value(S_image_verify_t *v, S_value_t *value, int depth);
 
-    value = S_object_get(obj, name, err);
-    if (value == NULL) {
-        if (err) {
-            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
+static int S_image_verify_slots(S_image_verify_t *v, S_value_t *values, size_t n, int depth) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (S_image_verify_value(v, &values[i], depth) == 0) {
+            return 0;
         }
     }
-    return value->type == S_VALUE_TYPE_NULL; 
+    return 1;
 }
 
-S_value_t *S_array_get(S_array_t *arr, size_t i, S_error_code_t *err) {
-    if (arr == NULL) {
-        if (err) {
-            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
-        }
-        return NULL;
+static int S_image_verify_array(S_image_verify_t *v, S_array_t *arr, int depth) {
+    S_value_t *values;
+    size_t    n;
+    size_t    i;
+
+    if (arr->base.body.refs != S_VALUE_REFS_POOLED || arr->base.body.flags != S_BODY_FLAG_IMAGE
+            || arr->base.up.parent != NULL || arr->base.cache != NULL) {
+        return 0;
     }
-    if (arr->values == NULL || i >= arr->num_values) {
-        if (err) {
-            *err = S_ERROR_CODE_OUT_OF_BOUNDS;
+    n = arr->num_values;
+    if (n == 0) {
+        return arr->values == NULL && arr->numbers == NULL;
+    }
+    if (n > v->image->range.len / sizeof (S_value_t)) {
+        return 0;
+    }
+    if (arr->numbers != NULL) {
+        if (S_image_verify_body(v, &arr->numbers, sizeof (double) * n) == NULL) {
+            return 0;
         }
-        return NULL;
+        values = S_image_verify_body(v, &arr->values, sizeof *values * n);
+        for (i = 0; values != NULL && i < n; i++) {
+            if (values[i].type != S_VALUE_TYPE_NUMBER || values[i].bits != 0) {
+                return 0; // Slots of packed numbers
+            }
+        }
+        return values != NULL;
     }
-    return arr->values[i];
-}
-
-S_bool_t S_array_get_bool(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_array_get(arr, i, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_BOOLEAN, 0);
-    return ((S_boolean_t *) value)->value;
+    values = S_image_verify_body(v, &arr->values, sizeof *values * n);
+    return values != NULL && S_image_verify_slots(v, values, n, depth);
 }
 
-double S_array_get_number(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_array_get(arr, i, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_NUMBER, 0.0);
-    return ((S_number_t *) value)->value;
-}
+static int S_image_verify_object(S_image_verify_t *v, S_object_t obj, int depth) {
+    S_object_entry_t *entries;
+    size_t           n;
+    size_t           i;
 
-S_object_t S_array_get_object(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
-    
-    value = S_array_get(arr, i, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_OBJECT, NULL);
-    return (S_object_t) value;
+    if (obj->base.body.refs != S_VALUE_REFS_POOLED || obj->base.body.flags != S_BODY_FLAG_IMAGE
+            || obj->base.up.parent != NULL || obj->base.cache != NULL) {
+        return 0;
+    }
+    n = obj->num_entries;
+    if (n == 0) {
+        return obj->entries == NULL;
+    }
+    if (n > v->image->range.len / sizeof *entries) {
+        return 0;
+    }
+    entries = S_image_verify_body(v, &obj->entries, sizeof *entries * n);
+    if (entries == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (entries[i].name.type != S_VALUE_TYPE_STRING
+                || ((entries[i].name.bits & S_VALUE_BITS_LAST) != 0) != (i == n - 1)
+                || S_image_verify_value(v, &entries[i].name, depth) == 0
+                || S_image_verify_value(v, &entries[i].value, depth) == 0) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-char *S_array_get_string(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
-    char      *s;
+static int S_image_verify_value(S_image_verify_t *v, S_value_t *value, int depth) {
+    S_string_t *str;
+    S_lexeme_t *lex;
+    void       *body;
 
-    value = S_array_get(arr, i, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_STRING, NULL);
-    s = calloc(1, ((S_string_t *) value)->len + 1);
-    if (s == NULL) {
-        if (err) {
-            *err = S_ERROR_CODE_MALLOC_ERR;
-        }
-        return NULL;
+    switch (value->type) {
+        case S_VALUE_TYPE_STRING:
+            if (value->bits & S_VALUE_BITS_INLINE) {
+                return (value->bits & S_VALUE_BITS_LEN) <= S_VALUE_INLINE_MAX;
+            }
+            str = S_image_verify_body(v, &value->as.body, sizeof *str);
+            return str != NULL && (value->bits & S_VALUE_BITS_IMAGE)
+                && S_image_verify_text(v, &str->body, str->data, str->len);
+        case S_VALUE_TYPE_NUMBER:
+            if (!(value->bits & S_VALUE_BITS_LEXEME)) {
+                return 1;
+            }
+            if (value->bits & S_VALUE_BITS_INLINE) { // Converted, as the image is read only
+                return (value->bits & S_VALUE_BITS_LEN) <= S_LEXEME_INLINE_MAX && !isnan(value->as.number);
+            }
+            lex = S_image_verify_body(v, &value->as.body, sizeof *lex);
+            return lex != NULL && (value->bits & S_VALUE_BITS_IMAGE) && !isnan(lex->value)
+                && S_image_verify_text(v, &lex->body, lex->data, lex->len);
+        case S_VALUE_TYPE_ARRAY:
+        case S_VALUE_TYPE_OBJECT:
+            if (!(value->bits & S_VALUE_BITS_IMAGE) || depth >= S_VALIDATE_MAX_DEPTH) {
+                return 0;
+            }
+            if (value->type == S_VALUE_TYPE_ARRAY) {
+                body = S_image_verify_body(v, &value->as.body, sizeof (S_array_t));
+                return body != NULL && S_image_verify_array(v, body, depth + 1);
+            }
+            body = S_image_verify_body(v, &value->as.body, sizeof (struct s_S_object));
+            return body != NULL && S_image_verify_object(v, body, depth + 1);
+        case S_VALUE_TYPE_BOOLEAN:
+        case S_VALUE_TYPE_NULL:
+            return 1;
+        default:
+            return 0;
     }
-    memcpy(s, ((S_string_t *) value)->data, ((S_string_t *) value)->len + 1);
-    return s;
 }
 
-S_array_t *S_array_get_array(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
+S_bool_t S_image_verify(S_image_t *image) {
+    S_image_verify_t v;
+    S_image_header_t header;
 
-    value = S_array_get(arr, i, err);
-    S_CHECK_VALUE(S_VALUE_TYPE_ARRAY, NULL);
-    return (S_array_t *) value;
+    if (image == NULL) {
+        return 0;
+    }
+    memcpy(&header, image->range.data, sizeof header);
+    v.image = image;
+    v.next = header.root + sizeof *image->root;
+    return S_image_verify_object(&v, image->root, 1);
 }
 
-S_bool_t S_array_is_null(S_array_t *arr, size_t i, S_error_code_t *err) {
-    S_value_t *value;
-
-    value = S_array_get(arr, i, err);
-    if (value == NULL) {
-        if (err) {
-            *err = S_ERROR_CODE_OBJECT_NOT_FOUND;
-        }
+void S_image_close(S_image_t **image) {
+    if (image == NULL || *image == NULL) {
+        return;
     }
-    return value->type == S_VALUE_TYPE_NULL; 
+    S_file_range_close(&(*image)->range);
+    free(*image);
+    *image = NULL;
 }
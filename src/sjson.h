@@ -2,25 +2,54 @@
 #define SJSON_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define S_WRITE_NUMBER_NUM_DECIMAL_POINT 10
+#define S_WRITE_CACHE_MIN_SIZE           64
+#define S_WRITE_CACHE_MAX_SIZE           4096
+#define S_INDEX_SUFFIX                   ".sjidx"
+#define S_VALIDATE_MAX_DEPTH             1024
+#define S_WRITE_PARALLEL_MIN_SIZE        1024
 
-typedef enum e_S_value_type     S_value_type_t;
 typedef struct s_S_value        S_value_t;
 typedef struct s_S_array        S_array_t;
 typedef struct s_S_object_entry S_object_entry_t;
-typedef S_object_entry_t        *S_object_t;
+typedef struct s_S_object       *S_object_t;
+typedef struct s_S_parser       S_parser_t;
+typedef struct s_S_index        S_index_t;
+typedef struct s_S_image        S_image_t;
 
 typedef enum {
     S_ERROR_CODE_OK = 0,
     S_ERROR_CODE_OBJECT_NOT_FOUND,
     S_ERROR_CODE_INVALID_TYPE,
     S_ERROR_CODE_MALLOC_ERR,
-    S_ERROR_CODE_OUT_OF_BOUNDS
+    S_ERROR_CODE_OUT_OF_BOUNDS,
+    S_ERROR_CODE_READ_ONLY,
+    S_ERROR_CODE_IO_ERR
 } S_error_code_t;
 
+typedef enum {
+    S_PARSE_FLAG_NONE          = 0,
+    S_PARSE_FLAG_VALIDATE_UTF8 = 1 << 0,
+    S_PARSE_FLAG_LAZY_NUMBERS  = 1 << 1
+} S_parse_flag_t;
+
+typedef enum e_S_value_type {
+    S_VALUE_TYPE_STRING = 0,
+    S_VALUE_TYPE_NUMBER,
+    S_VALUE_TYPE_OBJECT,
+    S_VALUE_TYPE_ARRAY,
+    S_VALUE_TYPE_BOOLEAN,
+    S_VALUE_TYPE_NULL
+} S_value_type_t;
+
 typedef unsigned char S_bool_t;
 
 /***
@@ -31,6 +60,77 @@ typedef unsigned char S_bool_t;
  ***/
 S_object_t S_parse(const char *data, size_t sz);
 
+/***
+ * Parses a JSON string into an object representation,
+ * with extra behaviour selected by flags.
+ *
+ * S_PARSE_FLAG_VALIDATE_UTF8: reject the document if any
+ * string contains malformed UTF-8.
+ *
+ * S_PARSE_FLAG_LAZY_NUMBERS: keep the text of numbers, and
+ * convert it the first time the number is read (the result is
+ * kept). S_write copies the text verbatim instead of
+ * reformatting it. Arrays of numbers are not packed (see
+ * S_array_get_numbers).
+ *
+ * @param const char * data The string data to parse
+ * @param size_t sz Size of the string being parsed
+ * @param unsigned int flags Bitwise OR of S_parse_flag_t values
+ * @return Object representation of the JSON string
+ ***/
+S_object_t S_parse_ex(const char *data, size_t sz, unsigned int flags);
+
+/***
+ * Parses only the listed fields of a JSON string. Each field
+ * is a dot separated key path ("user.address.city"); a path
+ * keeps the whole value it ends on, and passes through arrays
+ * onto each of their elements. Every other field is skipped
+ * without being allocated. Keys are compared as written in
+ * the document, escapes included. With no fields (fields is
+ * NULL or empty) nothing is kept: a valid document gives an
+ * empty object.
+ *
+ * Example:
+ * const char *fields[] = { "id", "items.price", NULL };
+ * S_object_t obj = S_parse_projected(data, sz, fields);
+ * @param const char * data The string data to parse
+ * @param size_t sz Size of the string being parsed
+ * @param const char * const * fields NULL terminated list of key paths
+ * @return Object representation of the kept fields
+ ***/
+S_object_t S_parse_projected(const char *data, size_t sz, const char *const *fields);
+
+/***
+ * Creates a parser context, for parsing many documents
+ * one after the other. The context keeps its memory between
+ * documents, so once it has grown to fit the largest of
+ * them parsing allocates next to nothing.
+ * @param unsigned int flags Bitwise OR of S_parse_flag_t values
+ * @return The parser context (heap allocated)
+ ***/
+S_parser_t *S_parser_create(unsigned int flags);
+
+/***
+ * Parses a JSON string using a parser context.
+ *
+ * The returned object belongs to the parser: it stays valid
+ * until the next S_parse_with or S_parser_destroy call on the
+ * same parser, and is read only (setters fail with
+ * S_ERROR_CODE_READ_ONLY). S_clone returns a heap copy of it
+ * which can outlive the parser.
+ * @param S_parser_t * parser The parser context to use
+ * @param const char * data The string data to parse
+ * @param size_t sz Size of the string being parsed
+ * @return Object representation of the JSON string
+ ***/
+S_object_t S_parse_with(S_parser_t *parser, const char *data, size_t sz);
+
+/***
+ * Frees a parser context and every object it returned.
+ * @param S_parser_t ** parser The parser context to destroy
+ ***/
+void S_parser_destroy(S_parser_t **parser);
+
 /***
  * Writes the JSON object into a string.
  * @param S_object_t obj The JSON object to print
@@ -38,6 +138,58 @@ S_object_t S_parse(const char *data, size_t sz);
  ***/
 char *S_write(S_object_t obj);
 
+/***
+ * Writes the JSON object into a string using up to nthreads
+ * threads. The elements of the first large container found
+ * from the root (at least S_WRITE_PARALLEL_MIN_SIZE fields or
+ * elements, following the biggest child otherwise) are split
+ * into ranges serialized concurrently, then concatenated.
+ * The result is the same string as S_write, which is used
+ * directly when there is nothing worth splitting.
+ * @param S_object_t obj The JSON object to print
+ * @param unsigned int nthreads Maximum number of threads
+ * @return String serialized JSON object (heap allocated)
+ ***/
+char *S_write_parallel(S_object_t obj, unsigned int nthreads);
+
+/***
+ * Writes the JSON object into its canonical string form:
+ * object fields sorted by name (bytewise), no whitespace,
+ * integers without decimals and other numbers with the
+ * fewest digits that read back as the same value. Strings
+ * are written as stored. Equal documents have equal
+ * canonical forms, whatever their field order.
+ * @param S_object_t obj The JSON object to print
+ * @return String canonical JSON object (heap allocated)
+ ***/
+char *S_write_canonical(S_object_t obj);
+
+/***
+ * Returns the 64 bit XXH64 hash of the canonical form of the
+ * JSON object (see S_write_canonical), computed while walking
+ * the object, without building the string.
+ *
+ * Example:
+ * S_hash(o) == XXH64(S_write_canonical(o), 0)
+ * @param S_object_t obj The JSON object to hash
+ * @return The hash, 0 on error
+ ***/
+uint64_t S_hash(S_object_t obj);
+
+/***
+ * Checks that a string is a valid JSON object, without
+ * building it and without allocating. Strings must be valid
+ * UTF-8 (as with S_PARSE_FLAG_VALIDATE_UTF8), nesting may not
+ * exceed S_VALIDATE_MAX_DEPTH and only whitespace may follow
+ * the root object.
+ * @param const char * data The string data to check
+ * @param size_t sz Size of the string being checked
+ * @param size_t * err_offset Set to the offset of the first
+ *                            invalid byte on failure (may be NULL)
+ * @return 1 if valid, 0 if not
+ ***/
+S_bool_t S_validate(const char *data, size_t sz, size_t *err_offset);
+
 /***
  * Helper functions for a JSON object.
  * These functions take the object, and the name of the
@@ -99,9 +251,239 @@ S_array_t  *S_array_get_array(S_array_t *arr, size_t i, S_error_code_t *err);
 S_bool_t   S_array_is_null(S_array_t *arr, size_t i, S_error_code_t *err);
 
 /***
- * Frees a JSON object and its value (recursively).
+ * Arrays holding only numbers are stored packed, as a plain
+ * array of doubles, which this function gives direct access
+ * to. The getters above work on packed arrays too: the first
+ * S_array_get on a packed array builds the values of its
+ * elements, which are kept until the array is released.
+ *
+ * Example:
+ * a = [1, 2, 3]
+ * S_array_get_numbers(a, &numbers, &n) = S_ERROR_CODE_OK, n = 3
+ * a = [1, null]
+ * S_array_get_numbers(a, &numbers, &n) = S_ERROR_CODE_INVALID_TYPE
+ * @param S_array_t * arr The array
+ * @param const double ** numbers Set to the numbers of the array
+ * @param size_t * n Set to the number of elements
+ * @return Error code, S_ERROR_CODE_INVALID_TYPE if not packed
+ ***/
+S_error_code_t S_array_get_numbers(S_array_t *arr, const double **numbers, size_t *n);
+
+/***
+ * Returns the number of elements of an array, 0 for NULL.
+ ***/
+size_t S_array_size(S_array_t *arr);
+
+/***
+ * Iteration over the fields of an object, in document order.
+ * Names and values are borrowed from the object.
+ *
+ * Example:
+ * for (e = S_object_first(o); e != NULL; e = S_object_entry_next(e)) {
+ *     name = S_object_entry_name(e, &len);
+ *     value = S_object_entry_value(e);
+ * }
+ ***/
+S_object_entry_t *S_object_first(S_object_t obj);
+S_object_entry_t *S_object_entry_next(S_object_entry_t *entry);
+const char       *S_object_entry_name(S_object_entry_t *entry, size_t *len);
+S_value_t        *S_object_entry_value(S_object_entry_t *entry);
+
+/***
+ * Helper functions for a value returned by S_object_get,
+ * S_array_get or S_object_entry_value.
+ *
+ * S_value_get_string_ref returns the string stored in the
+ * value, without copying it, and its length through len. It
+ * stays valid as long as the value.
+ *
+ * The error pointer will be set with the error code
+ * if any error occurs during the execution of the function
+ ***/
+S_value_type_t S_value_get_type(S_value_t *value);
+S_bool_t       S_value_get_bool(S_value_t *value, S_error_code_t *err);
+double         S_value_get_number(S_value_t *value, S_error_code_t *err);
+S_object_t     S_value_get_object(S_value_t *value, S_error_code_t *err);
+S_array_t      *S_value_get_array(S_value_t *value, S_error_code_t *err);
+const char     *S_value_get_string_ref(S_value_t *value, size_t *len, S_error_code_t *err);
+
+/***
+ * Setters for a JSON object and a JSON array.
+ * Object setters replace the field with the given name,
+ * or append it if the object has no such field. Array
+ * setters replace the element at the given index.
+ * Strings are stored as given, escapes included.
+ *
+ * Setters take the handle by address: a document shared
+ * with a clone (see S_clone) is copied on write and the
+ * handle updated to point to the private copy. A nested
+ * container returned by the getters can be modified only
+ * while no container on its way from the root is shared,
+ * otherwise S_ERROR_CODE_READ_ONLY is returned and it has to
+ * be reached with the edit functions below.
+ *
+ * Every array and object keeps the serialized form it had
+ * on the last S_write (when at least S_WRITE_CACHE_MIN_SIZE
+ * bytes long), which is reused until the container or one of
+ * its descendants is modified. Modifying a container marks it
+ * and all the containers on its way from the root dirty.
+ * Containers over S_WRITE_CACHE_MAX_SIZE bytes keep their form
+ * in blocks of elements and only rewrite the blocks on the way
+ * to a modification, so writing after a small edit costs
+ * little more than copying the output. Addresses returned by the edit
+ * functions must not be kept across S_write or S_clone calls.
+ *
+ * Example:
+ * o = {"a" : {"b" : 1}}
+ * S_object_set_number(S_object_edit_object(&o, "a", NULL), "b", 2);
+ ***/
+S_error_code_t S_object_set_bool(S_object_t *obj, const char *name, S_bool_t value);
+S_error_code_t S_object_set_number(S_object_t *obj, const char *name, double value);
+S_error_code_t S_object_set_string(S_object_t *obj, const char *name, const char *value);
+S_error_code_t S_object_set_null(S_object_t *obj, const char *name);
+
+S_error_code_t S_array_set_bool(S_array_t **arr, size_t i, S_bool_t value);
+S_error_code_t S_array_set_number(S_array_t **arr, size_t i, double value);
+S_error_code_t S_array_set_string(S_array_t **arr, size_t i, const char *value);
+S_error_code_t S_array_set_null(S_array_t **arr, size_t i);
+
+/***
+ * Returns the address of a child container which is about
+ * to be modified, to be passed to the setters. The parent
+ * and the child are copied if shared, and marked dirty.
+ * Children are stored inside their parent: the address is
+ * invalidated by adding a field to the parent.
+ ***/
+S_object_t *S_object_edit_object(S_object_t *obj, const char *name, S_error_code_t *err);
+S_array_t  **S_object_edit_array(S_object_t *obj, const char *name, S_error_code_t *err);
+S_object_t *S_array_edit_object(S_array_t **arr, size_t i, S_error_code_t *err);
+S_array_t  **S_array_edit_array(S_array_t **arr, size_t i, S_error_code_t *err);
+
+/***
+ * Returns a copy of a JSON object in O(1): both objects
+ * share their values, which are reference counted, until
+ * one of them is modified through the setters above.
+ *
+ * Shared values are never modified, so any number of
+ * threads can read (and S_write) a document at the same
+ * time, each holding its own clone. Every clone must be
+ * released with S_destroy.
+ * @param S_object_t obj The object to clone
+ * @return The clone
+ ***/
+S_object_t S_clone(S_object_t obj);
+
+/***
+ * Builds an index of the byte offsets of the elements of the
+ * top level array (or the member values of the top level
+ * object) of a JSON document, in a single pass. With a depth
+ * of 2, the elements of those which are containers are
+ * indexed too.
+ *
+ * The index can be saved next to the JSON file and loaded
+ * back later, to parse single elements of the file without
+ * reading the rest of it.
+ *
+ * Example:
+ * idx = S_index_build_file("records.json", 1);
+ * S_index_save(idx, "records.json");        (records.json.sjidx)
+ * ...
+ * idx = S_index_load("records.json");
+ * o = S_parse_index_element("records.json", idx, 42);
+ * @param const char * data / file The JSON document or its path
+ * @param size_t sz Size of the document
+ * @param int depth Number of levels to index (1 or 2)
+ * @return The index (heap allocated), NULL if malformed
+ ***/
+S_index_t  *S_index_build(const char *data, size_t sz, int depth);
+S_index_t  *S_index_build_file(const char *file, int depth);
+
+/***
+ * Saves / loads the index of a file, stored in the file
+ * path followed by S_INDEX_SUFFIX. Loading returns NULL for
+ * an index which is truncated, points outside of the source
+ * or was saved on a platform with another byte order.
+ ***/
+S_error_code_t S_index_save(S_index_t *idx, const char *file);
+S_index_t      *S_index_load(const char *file);
+
+/***
+ * Number of indexed elements, and number of indexed
+ * children of the element i (depth 2 only).
+ ***/
+size_t S_index_count(S_index_t *idx);
+size_t S_index_child_count(S_index_t *idx, size_t i);
+
+/***
+ * Parses the element i (or its child j) of an indexed file,
+ * mapping only the bytes of that element. The element must be
+ * an object. Returns NULL if the file changed size since the
+ * index was built.
+ ***/
+S_object_t S_parse_index_element(const char *file, S_index_t *idx, size_t i);
+S_object_t S_parse_index_child(const char *file, S_index_t *idx, size_t i, size_t j);
+
+/***
+ * Frees an index.
+ * @param S_index_t ** idx The index to destroy
+ ***/
+void S_index_destroy(S_index_t **idx);
+
+/***
+ * Saves a JSON object as an image: its values laid out as in
+ * memory, with relative pointers. The image can be mapped by
+ * any number of processes with S_image_open and read in place
+ * with the getters, without parsing: the mapped pages are
+ * shared through the page cache.
+ *
+ * The image is read only (setters return
+ * S_ERROR_CODE_READ_ONLY, S_clone makes a heap copy) and only
+ * valid while it stays open. It uses the byte order, sizes and
+ * value layout of the machine which saved it, which are checked
+ * when opened, along with the size of the file. Opening does
+ * not read the values: check images from untrusted sources with
+ * S_image_verify before use.
+ *
+ * Example:
+ * S_image_save(o, "reference.sjim");
+ * ...
+ * img = S_image_open("reference.sjim");
+ * S_object_get_number(S_image_root(img), "x", NULL);
+ * S_image_close(&img);
+ ***/
+S_error_code_t S_image_save(S_object_t obj, const char *file);
+S_image_t      *S_image_open(const char *file);
+
+/***
+ * Root object of an open image, owned by the image: it is
+ * released by S_image_close.
+ ***/
+S_object_t S_image_root(S_image_t *image);
+
+/***
+ * Checks every value of an open image, in a single pass: bodies
+ * within the file and in the order they were saved, lengths,
+ * types and nesting depth (up to S_VALIDATE_MAX_DEPTH).
+ * @param S_image_t * image The image to check
+ * @return true if the image can be read safely
+ ***/
+S_bool_t S_image_verify(S_image_t *image);
+
+/***
+ * Unmaps an image. Objects read from it become invalid.
+ * @param S_image_t ** image The image to close
+ ***/
+void S_image_close(S_image_t **image);
+
+/***
+ * Releases a JSON object, freeing it and its values
+ * (recursively) once no clone references them anymore.
  * @param S_object_t * obj The object to destry
  ***/
 void S_destroy(S_object_t *obj);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,403 @@
+#ifndef SJSON_HPP
+#define SJSON_HPP
+
+/*
+ * Header only C++17 interface to sjson.h.
+ *
+ * sjson::document owns a parsed object (move only, released
+ * on destruction). object, array and value are borrowed views
+ * into it, valid as long as the document is. Strings are
+ * returned as std::string_view into the document, never
+ * copied.
+ *
+ * Keys can be given as sjson::key literals, hashed at compile
+ * time. A key_index built over an object turns lookups into
+ * a binary search on hashes:
+ *
+ * using namespace sjson::literals;
+ * sjson::document doc = sjson::document::parse(text);
+ * sjson::key_index idx(doc.root());
+ * for (sjson::value item : idx["items"_key].as_array()) {
+ *     std::string_view name = item["name"_key].as_string();
+ * }
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sjson.h"
+
+namespace sjson {
+
+/* -------------------- Keys -------------------- */
+
+/*
+ * 64 bit FNV-1a, usable in constant expressions.
+ */
+constexpr std::uint64_t hash_key(std::string_view name) noexcept {
+    std::uint64_t h = 14695981039346656037ULL;
+
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+class key {
+public:
+    constexpr key(std::string_view name) noexcept : name_(name), hash_(hash_key(name)) {}
+    constexpr key(const char *name) noexcept : key(std::string_view(name)) {}
+
+    constexpr std::string_view name() const noexcept { return name_; }
+    constexpr std::uint64_t    hash() const noexcept { return hash_; }
+
+private:
+    std::string_view name_;
+    std::uint64_t    hash_;
+};
+
+namespace literals {
+
+constexpr key operator""_key(const char *name, std::size_t len) noexcept {
+    return key(std::string_view(name, len));
+}
+
+} // namespace literals
+
+/* ---------------------------------------------- */
+
+/* -------------------- Views -------------------- */
+
+enum class type {
+    string  = S_VALUE_TYPE_STRING,
+    number  = S_VALUE_TYPE_NUMBER,
+    object  = S_VALUE_TYPE_OBJECT,
+    array   = S_VALUE_TYPE_ARRAY,
+    boolean = S_VALUE_TYPE_BOOLEAN,
+    null    = S_VALUE_TYPE_NULL,
+    none    // Missing value
+};
+
+class object;
+class array;
+
+/*
+ * A borrowed value. Elements of packed (all number) arrays
+ * are read from the packed numbers: the number is held by the
+ * view, which has no S_value_t.
+ */
+class value {
+public:
+    value() noexcept = default;
+    explicit value(S_value_t *v) noexcept : v_(v) {}
+    explicit value(double number) noexcept : number_(number), packed_(true) {}
+
+    sjson::type get_type() const noexcept {
+        if (packed_) {
+            return type::number;
+        }
+        return v_ == nullptr ? type::none : static_cast<sjson::type>(S_value_get_type(v_));
+    }
+
+    explicit operator bool() const noexcept { return get_type() != type::none; }
+    bool is_null() const noexcept { return get_type() == type::null; }
+
+    std::string_view as_string() const noexcept {
+        const char *data;
+        std::size_t len = 0;
+
+        data = packed_ ? nullptr : S_value_get_string_ref(v_, &len, nullptr);
+        return data == nullptr ? std::string_view() : std::string_view(data, len);
+    }
+
+    double as_number(double fallback = 0) const noexcept {
+        if (packed_) {
+            return number_;
+        }
+        return get_type() == type::number ? S_value_get_number(v_, nullptr) : fallback;
+    }
+
+    bool as_bool(bool fallback = false) const noexcept {
+        return get_type() == type::boolean ? S_value_get_bool(v_, nullptr) != 0 : fallback;
+    }
+
+    inline object as_object() const noexcept;
+    inline array  as_array() const noexcept;
+    inline value  operator[](const key &k) const noexcept;
+    inline value  operator[](std::size_t i) const noexcept;
+
+    S_value_t *get() const noexcept { return v_; }
+
+private:
+    S_value_t *v_      = nullptr;
+    double    number_  = 0;
+    bool      packed_  = false;
+};
+
+struct field {
+    std::string_view name;
+    sjson::value     value;
+};
+
+class object {
+public:
+    class iterator {
+    public:
+        using value_type        = field;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        explicit iterator(S_object_entry_t *e) noexcept : e_(e) {}
+
+        field operator*() const noexcept {
+            const char  *name;
+            std::size_t len = 0;
+
+            name = S_object_entry_name(e_, &len);
+            return field{std::string_view(name, len), value(S_object_entry_value(e_))};
+        }
+
+        iterator &operator++() noexcept {
+            e_ = S_object_entry_next(e_);
+            return *this;
+        }
+
+        bool operator==(const iterator &o) const noexcept { return e_ == o.e_; }
+        bool operator!=(const iterator &o) const noexcept { return e_ != o.e_; }
+
+    private:
+        S_object_entry_t *e_;
+    };
+
+    object() noexcept = default;
+    explicit object(S_object_t o) noexcept : o_(o) {}
+
+    iterator begin() const noexcept { return iterator(S_object_first(o_)); }
+    iterator end() const noexcept { return iterator(nullptr); }
+
+    explicit operator bool() const noexcept { return o_ != nullptr; }
+
+    /*
+     * Linear search comparing lengths, then bytes: no strcmp on
+     * NUL terminated copies. For repeated lookups on the same
+     * object, use a key_index.
+     */
+    value find(std::string_view name) const noexcept {
+        for (field f : *this) {
+            if (f.name == name) {
+                return f.value;
+            }
+        }
+        return value();
+    }
+
+    /*
+     * Same linear search as find: the hash of the key is only
+     * used by a key_index.
+     */
+    value operator[](const key &k) const noexcept { return find(k.name()); }
+
+    S_object_t get() const noexcept { return o_; }
+
+private:
+    S_object_t o_ = nullptr;
+};
+
+class array {
+public:
+    class iterator {
+    public:
+        using value_type        = sjson::value;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator(const array *arr, std::size_t i) noexcept : arr_(arr), i_(i) {}
+
+        value operator*() const noexcept { return (*arr_)[i_]; }
+
+        iterator &operator++() noexcept {
+            i_++;
+            return *this;
+        }
+
+        bool operator==(const iterator &o) const noexcept { return i_ == o.i_; }
+        bool operator!=(const iterator &o) const noexcept { return i_ != o.i_; }
+
+    private:
+        const array *arr_;
+        std::size_t i_;
+    };
+
+    array() noexcept = default;
+    explicit array(S_array_t *a) noexcept : a_(a), size_(S_array_size(a)) {
+        if (S_array_get_numbers(a, &numbers_, &size_) != S_ERROR_CODE_OK) {
+            numbers_ = nullptr;
+        }
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool        empty() const noexcept { return size_ == 0; }
+
+    value operator[](std::size_t i) const noexcept {
+        if (i >= size_) {
+            return value();
+        }
+        return numbers_ != nullptr ? value(numbers_[i]) : value(S_array_get(a_, i, nullptr));
+    }
+
+    iterator begin() const noexcept { return iterator(this, 0); }
+    iterator end() const noexcept { return iterator(this, size_); }
+
+    explicit operator bool() const noexcept { return a_ != nullptr; }
+
+    S_array_t *get() const noexcept { return a_; }
+
+private:
+    S_array_t    *a_       = nullptr;
+    const double *numbers_ = nullptr;
+    std::size_t  size_     = 0;
+};
+
+inline object value::as_object() const noexcept {
+    return object(packed_ ? nullptr : S_value_get_object(v_, nullptr));
+}
+
+inline array value::as_array() const noexcept {
+    return array(packed_ ? nullptr : S_value_get_array(v_, nullptr));
+}
+
+inline value value::operator[](const key &k) const noexcept {
+    return as_object()[k];
+}
+
+inline value value::operator[](std::size_t i) const noexcept {
+    return as_array()[i];
+}
+
+/* ----------------------------------------------- */
+
+/* -------------------- Key index -------------------- */
+
+/*
+ * The fields of one object, sorted by key hash. Lookups with
+ * a key binary search the hashes and compare names only on a
+ * hash match. The object must outlive the index and must not
+ * be modified while the index is used.
+ */
+class key_index {
+public:
+    key_index() = default;
+
+    explicit key_index(object obj) {
+        for (field f : obj) {
+            entries_.push_back(entry{hash_key(f.name), f.name, f.value});
+        }
+        std::stable_sort(entries_.begin(), entries_.end(), [](const entry &a, const entry &b) {
+            return a.hash < b.hash;
+        });
+    }
+
+    value find(const key &k) const noexcept {
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), k.hash(),
+            [](const entry &e, std::uint64_t h) { return e.hash < h; });
+
+        for (; it != entries_.end() && it->hash == k.hash(); ++it) {
+            if (it->name == k.name()) {
+                return it->val;
+            }
+        }
+        return value();
+    }
+
+    value       operator[](const key &k) const noexcept { return find(k); }
+    std::size_t size() const noexcept { return entries_.size(); }
+
+private:
+    struct entry {
+        std::uint64_t    hash;
+        std::string_view name;
+        value            val;
+    };
+
+    std::vector<entry> entries_;
+};
+
+/* --------------------------------------------------- */
+
+/* -------------------- Document -------------------- */
+
+/*
+ * Owns a parsed object. Move only: use clone() for a second
+ * reference (O(1), copied on write by the C library).
+ */
+class document {
+public:
+    document() noexcept = default;
+    explicit document(S_object_t o) noexcept : o_(o) {}
+
+    document(const document &) = delete;
+    document &operator=(const document &) = delete;
+
+    document(document &&other) noexcept : o_(std::exchange(other.o_, nullptr)) {}
+
+    document &operator=(document &&other) noexcept {
+        if (this != &other) {
+            reset();
+            o_ = std::exchange(other.o_, nullptr);
+        }
+        return *this;
+    }
+
+    ~document() { reset(); }
+
+    static document parse(std::string_view data, unsigned int flags = S_PARSE_FLAG_NONE) {
+        return document(S_parse_ex(data.data(), data.size(), flags));
+    }
+
+    document clone() const { return document(S_clone(o_)); }
+
+    object root() const noexcept { return object(o_); }
+    value  operator[](const key &k) const noexcept { return root()[k]; }
+
+    explicit operator bool() const noexcept { return o_ != nullptr; }
+
+    std::string write() const {
+        std::string out;
+        char        *s;
+
+        s = o_ == nullptr ? nullptr : S_write(o_);
+        if (s != nullptr) {
+            out = s;
+            free(s);
+        }
+        return out;
+    }
+
+    /*
+     * Gives up ownership, for use with the C setters.
+     */
+    S_object_t release() noexcept { return std::exchange(o_, nullptr); }
+    S_object_t get() const noexcept { return o_; }
+
+    void reset() noexcept {
+        if (o_ != nullptr) {
+            S_destroy(&o_);
+        }
+    }
+
+private:
+    S_object_t o_ = nullptr;
+};
+
+/* -------------------------------------------------- */
+
+} // namespace sjson
+
+#endif
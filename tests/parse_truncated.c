@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sjson.h"
+
+/*
+ * Parses truncated documents from buffers of their exact size,
+ * so that a read past the end is caught by the sanitizers.
+ */
+
+static const char *S_truncated[] = {
+    "{\"a\":",
+    "{\"a\":[",
+    "{\"a\":[1",
+    "{\"a\":[1,",
+    "{\"b\":1,\"a\":[",
+    NULL
+};
+
+static const char S_document[] =
+    "{\"b\": 1, \"a\": [1, -2.5e3, \"x\", [true, null], {\"c\": 0.25}], \"d\": 12345}";
+
+static S_parser_t *S_parser;
+
+static S_object_t S_parse_by(int how, const char *data, size_t sz) {
+    static const char *const fields[] = {"a", NULL};
+
+    switch (how) {
+        case 0:
+            return S_parse(data, sz);
+        case 1:
+            return S_parse_projected(data, sz, fields);
+        case 2:
+            return S_parse_ex(data, sz, S_PARSE_FLAG_LAZY_NUMBERS);
+        default:
+            return S_parse_with(S_parser, data, sz);
+    }
+}
+
+/*
+ * Returns 1 if the parse succeeded, -1 on allocation failure.
+ */
+static int S_try(int how, const char *text, size_t sz) {
+    S_object_t obj;
+    char       *data;
+
+    data = malloc(sz > 0 ? sz : 1);
+    if (data == NULL) {
+        return -1;
+    }
+    memcpy(data, text, sz);
+    obj = S_parse_by(how, data, sz);
+    free(data);
+    if (obj == NULL) {
+        return 0;
+    }
+    if (how < 3) {
+        S_destroy(&obj);
+    }
+    return 1;
+}
+
+int main(void) {
+    size_t i;
+    size_t len;
+    int    how;
+    int    failed;
+
+    S_parser = S_parser_create(S_PARSE_FLAG_NONE);
+    if (S_parser == NULL) {
+        return 1;
+    }
+    failed = 0;
+    for (how = 0; how < 4; how++) {
+        for (i = 0; S_truncated[i] != NULL; i++) {
+            if (S_try(how, S_truncated[i], strlen(S_truncated[i])) != 0) {
+                fprintf(stderr, "parser %d accepted '%s'\n", how, S_truncated[i]);
+                failed = 1;
+            }
+        }
+        len = strlen(S_document);
+        for (i = 0; i < len; i++) {
+            if (S_try(how, S_document, i) != 0) {
+                fprintf(stderr, "parser %d accepted %zu bytes of the document\n", how, i);
+                failed = 1;
+            }
+        }
+        if (S_try(how, S_document, len) != 1) {
+            fprintf(stderr, "parser %d rejected the document\n", how);
+            failed = 1;
+        }
+    }
+    S_parser_destroy(&S_parser);
+    return failed;
+}
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sjson.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d depth] <file.json>\n", name);
+    fprintf(stderr, "       %s -g <i>[.<j>] <file.json>\n", name);
+}
+
+/*
+ * Reads a decimal number followed by sep (or the end of the
+ * string when sep is '\0'). Returns 0 on anything else.
+ */
+static int number(const char *s, char sep, size_t *value, const char **end)
+{
+    unsigned long n;
+    char          *p;
+
+    if (*s < '0' || *s > '9') {
+        return 0; // strtoul would skip spaces and accept a sign
+    }
+    errno = 0;
+    n = strtoul(s, &p, 10);
+    if (errno == ERANGE || p == s || *p != sep || n > (size_t)-1) {
+        return 0;
+    }
+    *value = n;
+    if (end != NULL) {
+        *end = p;
+    }
+    return 1;
+}
+
+static int build(const char *file, int depth)
+{
+    S_index_t *idx;
+
+    idx = S_index_build_file(file, depth);
+    if (idx == NULL) {
+        fprintf(stderr, "%s: cannot index\n", file);
+        return 1;
+    }
+    if (S_index_save(idx, file) != S_ERROR_CODE_OK) {
+        fprintf(stderr, "%s%s: cannot write\n", file, S_INDEX_SUFFIX);
+        S_index_destroy(&idx);
+        return 1;
+    }
+    printf("%s%s: %zu elements\n", file, S_INDEX_SUFFIX, S_index_count(idx));
+    S_index_destroy(&idx);
+    return 0;
+}
+
+static int get(const char *file, const char *pos)
+{
+    S_index_t  *idx;
+    S_object_t o;
+    const char *end;
+    char       *s;
+    size_t     i;
+    size_t     j;
+    int        child;
+
+    child = number(pos, '.', &i, &end) && number(end + 1, '\0', &j, NULL);
+    if (child == 0 && number(pos, '\0', &i, NULL) == 0) {
+        fprintf(stderr, "%s: bad position, expected <i> or <i>.<j>\n", pos);
+        return 2;
+    }
+    idx = S_index_load(file);
+    if (idx == NULL) {
+        fprintf(stderr, "%s%s: cannot load index\n", file, S_INDEX_SUFFIX);
+        return 1;
+    }
+    if (child) {
+        o = S_parse_index_child(file, idx, i, j);
+    } else {
+        o = S_parse_index_element(file, idx, i);
+    }
+    S_index_destroy(&idx);
+    if (o == NULL) {
+        fprintf(stderr, "%s: no object at %s\n", file, pos);
+        return 1;
+    }
+    s = S_write(o);
+    printf("%s\n", s);
+    free(s);
+    S_destroy(&o);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t depth;
+    int    res;
+
+    res = 2;
+    if (argc == 2 && argv[1][0] != '-') {
+        res = build(argv[1], 1);
+    } else if (argc == 4 && strcmp(argv[1], "-d") == 0) {
+        if (number(argv[2], '\0', &depth, NULL) && (depth == 1 || depth == 2)) {
+            res = build(argv[3], (int)depth);
+        }
+    } else if (argc == 4 && strcmp(argv[1], "-g") == 0) {
+        res = get(argv[3], argv[2]);
+    }
+    if (res == 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    return res;
+}